@@ -0,0 +1,201 @@
+#include <stlab/copy_on_write.hpp>
+#include <stlab/pool_allocator.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+using stlab::copy_on_write;
+
+namespace {
+
+// The payload is a vector of bytes so the value size can be varied at run time.
+using payload = std::vector<char>;
+
+// Ways of constructing the model: from the global heap or from stlab::pool_allocator.
+struct heap {
+    template <class Policy>
+    static auto make(std::size_t size) -> copy_on_write<payload, Policy> {
+        return copy_on_write<payload, Policy>(size, 'x');
+    }
+};
+
+struct pool {
+    template <class Policy>
+    static auto make(std::size_t size) -> copy_on_write<payload, Policy> {
+        return stlab::allocate_copy_on_write<payload, Policy>(stlab::pool_allocator<payload>(),
+                                                              size, 'x');
+    }
+};
+
+void value_sizes(benchmark::internal::Benchmark* b) {
+    b->RangeMultiplier(8)->Range(8, 1 << 20);
+}
+
+/**************************************************************************************************/
+
+// Construction and destruction of a unique value; dominated by allocation for small sizes.
+template <class Source, class Policy>
+void construct_destroy(benchmark::State& state) {
+    const auto size = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state) {
+        auto x = Source::template make<Policy>(size);
+        benchmark::DoNotOptimize(x);
+    }
+}
+
+BENCHMARK_TEMPLATE(construct_destroy, heap, stlab::threading::multi)->Apply(value_sizes);
+BENCHMARK_TEMPLATE(construct_destroy, pool, stlab::threading::multi)->Apply(value_sizes);
+
+// Copying and destroying a handle to a shared value; independent of the value size.
+template <class Policy>
+void copy_shared(benchmark::State& state) {
+    auto x = heap::make<Policy>(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        auto y = x;
+        benchmark::DoNotOptimize(y);
+    }
+}
+
+BENCHMARK_TEMPLATE(copy_shared, stlab::threading::multi)->Arg(8);
+BENCHMARK_TEMPLATE(copy_shared, stlab::threading::single)->Arg(8);
+BENCHMARK_TEMPLATE(copy_shared, stlab::layout::padded<>)->Arg(8);
+
+// Moving a handle; never touches the reference count.
+void move_handle(benchmark::State& state) {
+    auto x = heap::make<stlab::threading::multi>(8);
+    for (auto _ : state) {
+        auto y = std::move(x);
+        benchmark::DoNotOptimize(y);
+        x = std::move(y);
+    }
+}
+
+BENCHMARK(move_handle);
+
+// Filling and destroying a vector of handles to one value, one reference at a time.
+void fan_out_copies(benchmark::State& state) {
+    auto x = heap::make<stlab::threading::multi>(8);
+    const auto n = static_cast<std::size_t>(state.range(0));
+    std::vector<copy_on_write<payload>> copies;
+    copies.reserve(n);
+    for (auto _ : state) {
+        for (std::size_t i = 0; i != n; ++i)
+            copies.push_back(x);
+        copies.clear();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * n));
+}
+
+BENCHMARK(fan_out_copies)->Arg(64)->Arg(4096);
+
+// The same with share_n and release_range, one reference count operation each way.
+void fan_out_share_n(benchmark::State& state) {
+    auto x = heap::make<stlab::threading::multi>(8);
+    const auto n = static_cast<std::size_t>(state.range(0));
+    std::vector<copy_on_write<payload>> copies;
+    copies.reserve(n);
+    for (auto _ : state) {
+        x.share_n(std::back_inserter(copies), n);
+        copy_on_write<payload>::release_range(copies.begin(), copies.end());
+        copies.clear();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * n));
+}
+
+BENCHMARK(fan_out_share_n)->Arg(64)->Arg(4096);
+
+/**************************************************************************************************/
+
+// write() on a shared handle, which detaches by copying the value.
+template <class Source, class Policy>
+void write_shared(benchmark::State& state) {
+    auto x = Source::template make<Policy>(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        auto y = x;
+        benchmark::DoNotOptimize(y.write().data());
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(write_shared, heap, stlab::threading::multi)->Apply(value_sizes);
+BENCHMARK_TEMPLATE(write_shared, pool, stlab::threading::multi)->Apply(value_sizes);
+
+// write() on a unique handle, which only checks the count.
+template <class Policy>
+void write_unique(benchmark::State& state) {
+    auto x = heap::make<Policy>(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x.write().data());
+    }
+}
+
+BENCHMARK_TEMPLATE(write_unique, stlab::threading::multi)->Arg(8);
+BENCHMARK_TEMPLATE(write_unique, stlab::threading::single)->Arg(8);
+
+// write(transform, inplace) appending one element, on shared and unique handles.
+template <class Source>
+void write_transform_shared(benchmark::State& state) {
+    auto x = Source::template make<stlab::threading::multi>(
+        static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        auto y = x;
+        y.write(
+            [](const payload& v) {
+                payload r;
+                r.reserve(v.size() + 1);
+                r.insert(r.end(), v.begin(), v.end());
+                r.push_back('y');
+                return r;
+            },
+            [](payload& v) { v.push_back('y'); });
+        benchmark::DoNotOptimize(y);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(write_transform_shared, heap)->Apply(value_sizes);
+BENCHMARK_TEMPLATE(write_transform_shared, pool)->Apply(value_sizes);
+
+void write_transform_unique(benchmark::State& state) {
+    auto x = heap::make<stlab::threading::multi>(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        x.write([](const payload& v) { return v; }, [](payload& v) { v.back() = 'y'; });
+        benchmark::DoNotOptimize(x);
+    }
+}
+
+BENCHMARK(write_transform_unique)->Arg(8);
+
+/**************************************************************************************************/
+
+// Equality of two handles sharing a value; short-circuits on identity.
+void compare_shared(benchmark::State& state) {
+    auto x = heap::make<stlab::threading::multi>(static_cast<std::size_t>(state.range(0)));
+    auto y = x;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x == y);
+    }
+}
+
+BENCHMARK(compare_shared)->Apply(value_sizes);
+
+// Equality of two handles to distinct but equal values; compares the values.
+void compare_unique(benchmark::State& state) {
+    auto x = heap::make<stlab::threading::multi>(static_cast<std::size_t>(state.range(0)));
+    auto y = heap::make<stlab::threading::multi>(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x == y);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+
+BENCHMARK(compare_unique)->Apply(value_sizes);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,425 @@
+#include <stlab/copy_on_write.hpp>
+#include <stlab/pool_allocator.hpp>
+#include <stlab/reclaim.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define STLAB_SCALABILITY_PERF_EVENTS 1
+#endif
+#endif
+
+/*
+    A multi-threaded harness for copy_on_write, which runs sharing patterns at increasing thread
+    counts and reports throughput, latency percentiles and, where perf events are available,
+    hardware counters per operation. Reference count contention shows as rising cycles and cache
+    misses per operation, and falling instructions per cycle, as threads are added.
+
+    copy-on-write-scalability [--threads=1,2,4,...] [--duration=ms] [--size=bytes]
+                              [--filter=text] [--pin] [--csv]
+*/
+
+using stlab::copy_on_write;
+
+namespace {
+
+using payload = std::vector<char>;
+using clock_type = std::chrono::steady_clock;
+
+// Ways of constructing the model: from the global heap or from stlab::pool_allocator.
+struct heap {
+    template <class Policy>
+    static auto make(std::size_t size) -> copy_on_write<payload, Policy> {
+        return copy_on_write<payload, Policy>(size, 'x');
+    }
+};
+
+struct pool {
+    template <class Policy>
+    static auto make(std::size_t size) -> copy_on_write<payload, Policy> {
+        return stlab::allocate_copy_on_write<payload, Policy>(stlab::pool_allocator<payload>(),
+                                                              size, 'x');
+    }
+};
+
+// Keeps the compiler from discarding an operation whose result is unused.
+template <class T>
+void escape(T& x) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&x) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &x;
+#endif
+}
+
+struct options {
+    std::vector<std::size_t> threads{1, 2, 4, 8, 16, 32, 64, 128};
+    std::chrono::milliseconds duration{200};
+    std::size_t size{64};
+    std::string filter;
+    bool pin{false};
+    bool csv{false};
+};
+
+/**************************************************************************************************/
+
+// Hardware counters for the calling thread, where perf_event_open is permitted.
+class perf_counters {
+public:
+    enum { cycles, instructions, cache_references, cache_misses, count };
+
+#if defined(STLAB_SCALABILITY_PERF_EVENTS)
+    perf_counters() {
+        const std::uint64_t configs[count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                              PERF_COUNT_HW_CACHE_REFERENCES,
+                                              PERF_COUNT_HW_CACHE_MISSES};
+        for (int i = 0; i != count; ++i) {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            _fd[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    auto operator=(const perf_counters&) -> perf_counters& = delete;
+
+    ~perf_counters() {
+        for (int fd : _fd)
+            if (fd != -1) ::close(fd);
+    }
+
+    void start() noexcept {
+        for (int fd : _fd)
+            if (fd != -1) ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    void stop() noexcept {
+        for (int fd : _fd)
+            if (fd != -1) ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    // Adds the counts to `totals`, clearing `valid[i]` for a counter which is not available.
+    void accumulate(std::uint64_t (&totals)[count], bool (&valid)[count]) const noexcept {
+        for (int i = 0; i != count; ++i) {
+            std::uint64_t value = 0;
+            if (_fd[i] == -1 || ::read(_fd[i], &value, sizeof(value)) != sizeof(value)) {
+                valid[i] = false;
+            } else {
+                totals[i] += value;
+            }
+        }
+    }
+
+private:
+    int _fd[count];
+#else
+    void start() noexcept {}
+    void stop() noexcept {}
+    void accumulate(std::uint64_t (&)[count], bool (&valid)[count]) const noexcept {
+        std::fill(std::begin(valid), std::end(valid), false);
+    }
+#endif
+};
+
+// Pins the calling thread to the `index`th CPU it is allowed to run on, modulo their number.
+void pin_thread(std::size_t index) {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    const auto n = static_cast<std::size_t>(CPU_COUNT(&allowed));
+    if (n == 0) return;
+    index %= n;
+    for (int cpu = 0; cpu != CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (index-- != 0) continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        (void)::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        return;
+    }
+#else
+    (void)index;
+#endif
+}
+
+/**************************************************************************************************/
+
+struct result {
+    std::uint64_t operations{0};
+    double seconds{0};
+    double latency_ns[4]{}; // p50, p90, p99, p99.9
+    std::uint64_t counters[perf_counters::count]{};
+    bool counters_valid[perf_counters::count]{};
+};
+
+// One in every `sample_interval` operations is timed, so the clock does not dominate.
+constexpr std::uint64_t sample_interval = 64;
+
+/*
+    Runs `threads` workers for the configured duration. `make_worker(i)` is called on the `i`th
+    thread and returns the operation that thread repeats.
+*/
+template <class MakeWorker>
+auto run(const options& opt, std::size_t threads, MakeWorker make_worker) -> result {
+    std::atomic<std::size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+
+    struct alignas(64) thread_result {
+        std::uint64_t operations{0};
+        clock_type::time_point end;
+        std::vector<std::uint32_t> samples;
+        std::uint64_t counters[perf_counters::count]{};
+        bool counters_valid[perf_counters::count]{true, true, true, true};
+    };
+    std::vector<thread_result> results(threads);
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (std::size_t i = 0; i != threads; ++i) {
+        workers.emplace_back([&, i] {
+            if (opt.pin) pin_thread(i);
+            thread_result& r = results[i];
+            r.samples.reserve(1 << 16);
+            auto op = make_worker(i);
+            perf_counters counters;
+
+            ready.fetch_add(1, std::memory_order_release);
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            counters.start();
+            std::uint64_t n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto t0 = clock_type::now();
+                op();
+                auto t1 = clock_type::now();
+                r.samples.push_back(static_cast<std::uint32_t>(std::min<std::int64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count(),
+                    UINT32_MAX)));
+                for (std::uint64_t k = 1; k != sample_interval; ++k)
+                    op();
+                n += sample_interval;
+            }
+            counters.stop();
+            r.end = clock_type::now();
+            r.operations = n;
+            counters.accumulate(r.counters, r.counters_valid);
+        });
+    }
+
+    while (ready.load(std::memory_order_acquire) != threads)
+        std::this_thread::yield();
+    const auto start = clock_type::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(opt.duration);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& w : workers)
+        w.join();
+
+    result total;
+    std::fill(std::begin(total.counters_valid), std::end(total.counters_valid), true);
+    std::vector<std::uint32_t> samples;
+    auto end = start;
+    for (auto& r : results) {
+        total.operations += r.operations;
+        end = std::max(end, r.end);
+        samples.insert(samples.end(), r.samples.begin(), r.samples.end());
+        for (int k = 0; k != perf_counters::count; ++k) {
+            total.counters[k] += r.counters[k];
+            total.counters_valid[k] = total.counters_valid[k] && r.counters_valid[k];
+        }
+    }
+    total.seconds = std::chrono::duration<double>(end - start).count();
+
+    std::sort(samples.begin(), samples.end());
+    const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+    for (int k = 0; k != 4 && !samples.empty(); ++k) {
+        auto index = static_cast<std::size_t>(quantiles[k] * static_cast<double>(samples.size()));
+        total.latency_ns[k] = samples[std::min(index, samples.size() - 1)];
+    }
+    return total;
+}
+
+/**************************************************************************************************/
+
+// Every thread copies and destroys a handle to one shared snapshot: one contended count.
+template <class Source, class Policy>
+auto copy_snapshot(const options& opt, std::size_t threads) -> result {
+    const auto shared = Source::template make<Policy>(opt.size);
+    return run(opt, threads, [&](std::size_t) {
+        return [&shared] {
+            auto copy = shared;
+            escape(copy);
+        };
+    });
+}
+
+// Every thread takes a copy of one shared value and writes to it, so each operation detaches:
+// an allocation and copy of the value, and two operations on the contended count.
+template <class Source, class Policy>
+auto detach_shared(const options& opt, std::size_t threads) -> result {
+    const auto shared = Source::template make<Policy>(opt.size);
+    return run(opt, threads, [&](std::size_t) {
+        return [&shared, local = shared]() mutable {
+            local = shared;
+            local.write()[0] = 'y';
+            escape(local);
+        };
+    });
+}
+
+// Every thread default constructs and destroys values, which all share the default model.
+template <class Source, class Policy>
+auto default_construct(const options& opt, std::size_t threads) -> result {
+    return run(opt, threads, [](std::size_t) {
+        return [] {
+            copy_on_write<payload, Policy> x;
+            escape(x);
+        };
+    });
+}
+
+struct scenario {
+    const char* name;
+    const char* configuration;
+    result (*run)(const options&, std::size_t);
+};
+
+#define STLAB_SCALABILITY_SCENARIOS(NAME)                                                      \
+    scenario{#NAME, "multi/heap", &NAME<heap, stlab::threading::multi>},                       \
+        scenario{#NAME, "padded/heap", &NAME<heap, stlab::layout::padded<>>},                  \
+        scenario{#NAME, "multi/pool", &NAME<pool, stlab::threading::multi>},                   \
+        scenario{#NAME, "epoch/heap", &NAME<heap, stlab::reclaim::epoch<>>}
+
+const scenario scenarios[] = {STLAB_SCALABILITY_SCENARIOS(copy_snapshot),
+                              STLAB_SCALABILITY_SCENARIOS(detach_shared),
+                              STLAB_SCALABILITY_SCENARIOS(default_construct)};
+
+#undef STLAB_SCALABILITY_SCENARIOS
+
+/**************************************************************************************************/
+
+auto parse(int argc, char** argv, options& opt) -> bool {
+    for (int i = 1; i != argc; ++i) {
+        const char* arg = argv[i];
+        auto value = [arg](const char* prefix) -> const char* {
+            const std::size_t n = std::strlen(prefix);
+            return std::strncmp(arg, prefix, n) == 0 ? arg + n : nullptr;
+        };
+        if (const char* threads = value("--threads=")) {
+            opt.threads.clear();
+            for (char* end = nullptr;; threads = end + 1) {
+                auto n = std::strtoul(threads, &end, 10);
+                if (end == threads || n == 0) return false;
+                opt.threads.push_back(n);
+                if (*end != ',') break;
+            }
+        } else if (const char* duration = value("--duration=")) {
+            opt.duration = std::chrono::milliseconds(std::strtoul(duration, nullptr, 10));
+        } else if (const char* size = value("--size=")) {
+            opt.size = std::max<std::size_t>(1, std::strtoul(size, nullptr, 10));
+        } else if (const char* filter = value("--filter=")) {
+            opt.filter = filter;
+        } else if (std::strcmp(arg, "--pin") == 0) {
+            opt.pin = true;
+        } else if (std::strcmp(arg, "--csv") == 0) {
+            opt.csv = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Prints `total / operations`, or a placeholder if the counter is not available.
+void print_per_op(const result& r, int counter, bool csv) {
+    if (!r.counters_valid[counter] || r.operations == 0) {
+        std::printf(csv ? "," : " %9s", "n/a");
+        return;
+    }
+    const double value =
+        static_cast<double>(r.counters[counter]) / static_cast<double>(r.operations);
+    std::printf(csv ? ",%.3f" : " %9.2f", value);
+}
+
+void print(const scenario& s, std::size_t threads, const result& r, bool csv) {
+    const double throughput = static_cast<double>(r.operations) / r.seconds;
+    if (csv) {
+        std::printf("%s,%s,%zu,%.0f,%.0f,%.0f,%.0f,%.0f", s.name, s.configuration, threads,
+                    throughput, r.latency_ns[0], r.latency_ns[1], r.latency_ns[2],
+                    r.latency_ns[3]);
+    } else {
+        std::printf("%-18s %-12s %7zu %12.4g %8.0f %8.0f %8.0f %8.0f", s.name, s.configuration,
+                    threads, throughput, r.latency_ns[0], r.latency_ns[1], r.latency_ns[2],
+                    r.latency_ns[3]);
+    }
+    print_per_op(r, perf_counters::cycles, csv);
+    print_per_op(r, perf_counters::instructions, csv);
+    print_per_op(r, perf_counters::cache_references, csv);
+    print_per_op(r, perf_counters::cache_misses, csv);
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+} // namespace
+
+/**************************************************************************************************/
+
+auto main(int argc, char** argv) -> int {
+    options opt;
+    if (!parse(argc, argv, opt)) {
+        std::fprintf(stderr,
+                     "usage: %s [--threads=1,2,4,...] [--duration=ms] [--size=bytes] "
+                     "[--filter=text] [--pin] [--csv]\n",
+                     argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (opt.csv) {
+        std::printf("scenario,configuration,threads,ops_per_second,p50_ns,p90_ns,p99_ns,p999_ns,"
+                    "cycles_per_op,instructions_per_op,cache_references_per_op,"
+                    "cache_misses_per_op\n");
+    } else {
+        std::printf("# %u hardware threads, %zu byte values, %lld ms per run; latencies in ns "
+                    "include the clock, counters are per operation\n",
+                    std::thread::hardware_concurrency(), opt.size,
+                    static_cast<long long>(opt.duration.count()));
+        std::printf("%-18s %-12s %7s %12s %8s %8s %8s %8s %9s %9s %9s %9s\n", "scenario",
+                    "config", "threads", "ops/s", "p50", "p90", "p99", "p99.9", "cycles",
+                    "instrs", "cache-ref", "cache-miss");
+    }
+
+    for (const auto& s : scenarios) {
+        const std::string name = std::string(s.name) + "/" + s.configuration;
+        if (!opt.filter.empty() && name.find(opt.filter) == std::string::npos) continue;
+        for (std::size_t threads : opt.threads)
+            print(s, threads, s.run(opt, threads), opt.csv);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,267 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file atomic_copy_on_write.hpp
+    @brief Atomic publication of copy_on_write values
+
+    This file contains stlab::atomic_copy_on_write, a copy_on_write handle which may be loaded and
+    stored concurrently from multiple threads without a mutex.
+*/
+
+#ifndef STLAB_ATOMIC_COPY_ON_WRITE_HPP
+#define STLAB_ATOMIC_COPY_ON_WRITE_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+#include <stlab/reclaim.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    An atomic `copy_on_write<T, Policy>` handle, in the manner of `std::atomic<std::shared_ptr>`.
+
+    Concurrent load(), store(), exchange() and compare_exchange() on the same object are safe.
+    Readers obtain a snapshot which remains valid however the published value changes, and never
+    block writers.
+
+    The implementation uses split reference counts. The handle is a single word holding the model
+    pointer and, in the low bits freed by the model's alignment, a count of references which loads
+    have taken. When a value is published the atomic reserves a batch of references on it in one
+    operation, so a load is a single compare-and-swap on the word and does not touch the shared
+    reference count. The load which takes the last reference of a batch reserves another; loads on
+    other threads wait for that step, so load() is not lock-free: a load may wait for as long as the
+    thread reserving the batch is suspended. store(), exchange() and borrow() never wait, and
+    compare_exchange() only waits when it fails and loads the current value. A larger model
+    alignment, such as from layout::padded, makes the batches larger and the waits rarer.
+
+    With the reclaim::epoch policy, borrow() gives readers access to the published value without
+    taking a reference at all. A value which has been published is then never modified in place,
+    so a write through a handle to it, even a unique one returned by exchange(), makes a copy.
+
+    `Policy` must use the atomic counter of threading::multi and must not store values inline.
+*/
+template <class T, class Policy = threading::multi>
+class atomic_copy_on_write {
+public:
+    using value_type = copy_on_write<T, Policy>;
+
+private:
+    using model = typename value_type::model;
+
+    static_assert(!value_type::is_inline, "atomic_copy_on_write requires shared storage");
+    static_assert(std::is_same_v<typename Policy::counter, threading::multi::counter>,
+                  "atomic_copy_on_write requires the threading::multi counter");
+
+    /*
+        The number of references in a batch. While a value is published the atomic owns
+        `batch - tag + 1` references on it: the untaken references of the batch plus its own.
+    */
+    static constexpr std::uintptr_t batch = alignof(model) - 1;
+    static constexpr std::uintptr_t tag_mask = batch;
+
+    static_assert(batch != 0 && (alignof(model) & batch) == 0,
+                  "model alignment must be a power of two of at least 2");
+
+    mutable std::atomic<std::uintptr_t> _word;
+
+    static auto pointer(std::uintptr_t w) noexcept -> model* {
+        return reinterpret_cast<model*>(w & ~tag_mask);
+    }
+
+    static auto tag(std::uintptr_t w) noexcept -> std::uintptr_t { return w & tag_mask; }
+
+    /// Takes ownership of the reference held by `x` and reserves a batch on it.
+    static auto install(value_type&& x) noexcept -> std::uintptr_t {
+        assert(x._self && "FATAL (sparent) : using a moved copy_on_write object");
+
+        model* m = std::exchange(x._self, nullptr);
+        if (!value_type::is_default(m)) {
+            m->mark_published();
+            m->_count.add(batch);
+        }
+        return reinterpret_cast<std::uintptr_t>(m);
+    }
+
+    /// Releases the references owned by a word which is no longer published, keeping `keep`.
+    static void uninstall(std::uintptr_t w, std::size_t keep = 0) noexcept {
+        model* m = pointer(w);
+        if (value_type::is_default(m)) return;
+        const std::size_t n = batch - tag(w) + 1 - keep;
+        if (n != 0 && m->_count.release(n)) value_type::retire(m);
+    }
+
+    static auto adopt(model* m) noexcept -> value_type {
+        return value_type(typename value_type::adopt_t{}, m);
+    }
+
+    /// Called by the load which took the last reference of the batch in `w`.
+    void replenish(std::uintptr_t w) const noexcept {
+        model* m = pointer(w);
+        m->_count.add(batch);
+        if (!_word.compare_exchange_strong(w, w & ~tag_mask, std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+            // The value was replaced; the caller's reference keeps the count from reaching zero.
+            (void)m->_count.release(batch);
+        }
+    }
+
+public:
+    /*!
+        @brief Constructs an object holding a default constructed value.
+    */
+    atomic_copy_on_write() noexcept(std::is_nothrow_constructible_v<T>) :
+        _word(install(value_type())) {}
+
+    /*!
+        @brief Constructs an object holding `x`.
+    */
+    explicit atomic_copy_on_write(value_type x) noexcept : _word(install(std::move(x))) {}
+
+    atomic_copy_on_write(const atomic_copy_on_write&) = delete;
+    auto operator=(const atomic_copy_on_write&) -> atomic_copy_on_write& = delete;
+
+    ~atomic_copy_on_write() { uninstall(_word.load(std::memory_order_acquire)); }
+
+    /*!
+        @brief Returns a snapshot of the current value. May wait for a concurrent load which is
+       reserving the next batch of references.
+    */
+    [[nodiscard]] auto load() const noexcept -> value_type {
+        std::uintptr_t w = _word.load(std::memory_order_acquire);
+        for (;;) {
+            model* m = pointer(w);
+            if (value_type::is_default(m)) return adopt(m);
+            if (tag(w) == batch) {
+                // Another load is reserving the next batch.
+                std::this_thread::yield();
+                w = _word.load(std::memory_order_acquire);
+                continue;
+            }
+            if (_word.compare_exchange_weak(w, w + 1, std::memory_order_acquire,
+                                            std::memory_order_acquire)) {
+                if (tag(w) + 1 == batch) replenish(w + 1);
+                return adopt(m);
+            }
+        }
+    }
+
+    operator value_type() const noexcept { return load(); }
+
+    /*!
+        Read access to the value which was published when the guard was obtained from borrow().
+        The guard pins the calling thread, keeping the value alive, and must be destroyed on that
+        thread. It is intended for short reads: while it exists no value released by any thread
+        is destroyed.
+    */
+    class read_guard {
+        reclaim::epoch_guard _pin;
+        const T* _value;
+
+        friend class atomic_copy_on_write;
+
+        explicit read_guard(const atomic_copy_on_write& x) :
+            _value(&value_type::value(pointer(x._word.load(std::memory_order_acquire)))) {}
+
+    public:
+        read_guard(const read_guard&) = delete;
+        auto operator=(const read_guard&) -> read_guard& = delete;
+
+        [[nodiscard]] auto get() const noexcept -> const T& { return *_value; }
+        auto operator*() const noexcept -> const T& { return *_value; }
+        auto operator->() const noexcept -> const T* { return _value; }
+    };
+
+    /*!
+        @brief Returns a guard giving read access to the current value without modifying any
+       reference count. Requires the reclaim::epoch policy.
+    */
+    [[nodiscard]] auto borrow() const -> read_guard {
+        static_assert(detail::is_epoch_reclaimed_v<Policy>,
+                      "borrow() requires the reclaim::epoch policy");
+        return read_guard(*this);
+    }
+
+    /*!
+        @brief Publishes `x`.
+    */
+    void store(value_type x) noexcept {
+        uninstall(_word.exchange(install(std::move(x)), std::memory_order_acq_rel));
+    }
+
+    auto operator=(value_type x) noexcept -> atomic_copy_on_write& {
+        store(std::move(x));
+        return *this;
+    }
+
+    /*!
+        @brief Publishes `x` and returns the value it replaced.
+    */
+    auto exchange(value_type x) noexcept -> value_type {
+        std::uintptr_t old = _word.exchange(install(std::move(x)), std::memory_order_acq_rel);
+        uninstall(old, 1);
+        return adopt(pointer(old));
+    }
+
+    /*!
+        @brief Publishes `desired` if the current value is identical to `expected`, and returns
+       true. Otherwise loads the current value into `expected` and returns false.
+    */
+    auto compare_exchange(value_type& expected, value_type desired) noexcept -> bool {
+        assert(expected._self && "FATAL (sparent) : using a moved copy_on_write object");
+
+        std::uintptr_t w = _word.load(std::memory_order_relaxed);
+        if (pointer(w) != expected._self) {
+            expected = load();
+            return false;
+        }
+        std::uintptr_t d = install(std::move(desired));
+        do {
+            if (_word.compare_exchange_weak(w, d, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+                uninstall(w);
+                return true;
+            }
+        } while (pointer(w) == expected._self);
+
+        // Release the reserved batch and the reference taken from `desired`.
+        uninstall(d);
+        expected = load();
+        return false;
+    }
+
+    /*!
+        @brief Returns false: although no operation uses a mutex, load() may wait for a concurrent
+       load which is reserving references.
+    */
+    [[nodiscard]] auto is_lock_free() const noexcept -> bool { return is_always_lock_free; }
+
+    static constexpr bool is_always_lock_free = false;
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -52,6 +52,7 @@
     @section features_sec Key Features
 
     - **Thread-safe**: Uses atomic reference counting for safe concurrent access
+    - **Allocator-aware**: Storage can come from any allocator, including `std::pmr`
     - **Header-only**: No compilation required, just include the header
     - **C++17**: Leverages modern C++ features for clean, efficient implementation
 
@@ -98,54 +99,1160 @@
 /**************************************************************************************************/
 
 #include <atomic>
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
+
+/*!
+    Define `STLAB_COPY_ON_WRITE_INSTRUMENTATION` to 1 to count allocations, detaches and in-place
+    writes per element type (see stlab::instrumentation). It must have the same value in every
+    translation unit of a program. When 0, the default, the instrumentation is compiled out.
+*/
+#ifndef STLAB_COPY_ON_WRITE_INSTRUMENTATION
+#define STLAB_COPY_ON_WRITE_INSTRUMENTATION 0
+#endif
+
+#if STLAB_COPY_ON_WRITE_INSTRUMENTATION
+#include <stlab/size_of.hpp>
+
+#include <typeinfo>
+#endif
+
+/**************************************************************************************************/
+
+/*!
+    The stlab namespace contains utilities and components for modern C++ development.
+*/
+namespace stlab {
+
+/**************************************************************************************************/
+
+namespace detail {
+
+/*
+    Defaults for the options of a copy_on_write policy. Policies derive from one of the threading
+    policies, which supply these, and adaptors such as layout::padded override individual options.
+*/
+struct policy_defaults {
+    static constexpr std::size_t value_alignment = 0;
+
+    static constexpr bool cache_hash = false;
+
+    static constexpr bool cache_derived = false;
+
+    static constexpr bool track_dirty = false;
+
+    static constexpr bool track_version = false;
+
+    /// Called with a model, holding `value`, whose last reference was released; `destroy(model)`
+    /// frees it.
+    template <class T>
+    static void reclaim(const T& value, void* model, void (*destroy)(void*) noexcept) noexcept {
+        (void)value;
+        destroy(model);
+    }
+
+    template <class T>
+    static constexpr bool store_inline = false;
+
+    static constexpr bool external_values = false;
+
+    static constexpr bool weak_references = false;
+
+    static constexpr bool epoch_reclaimed = false;
+};
+
+/*
+    The hash cache of a model when the policy enables hashing::cached; otherwise an empty base.
+    Concurrent first uses may each compute the hash, which is benign as they store the same value.
+    Invalidation only happens through a unique object, which no other thread can be reading.
+*/
+template <bool Cache>
+struct hash_cache {
+    void invalidate_hash() noexcept {}
+};
+
+template <>
+struct hash_cache<true> {
+    mutable std::atomic<std::size_t> _hash{0};
+    mutable std::atomic<bool> _hash_valid{false};
+
+    void invalidate_hash() noexcept { _hash_valid.store(false, std::memory_order_relaxed); }
+
+    template <class T>
+    auto cached_hash(const T& x) const -> std::size_t {
+        if (_hash_valid.load(std::memory_order_acquire))
+            return _hash.load(std::memory_order_relaxed);
+        std::size_t h = std::hash<T>{}(x);
+        _hash.store(h, std::memory_order_relaxed);
+        _hash_valid.store(true, std::memory_order_release);
+        return h;
+    }
+};
+
+/*
+    A derived value cached in a model, identified by the address of derived_key for its tag and
+    type. Entries are only added, with a lock-free push, until the model is modified in place or
+    destroyed, which only happens through a unique object.
+*/
+struct derived_entry {
+    const void* _key;
+    derived_entry* _next{nullptr};
+    std::once_flag _once;
+
+    explicit derived_entry(const void* key) noexcept : _key(key) {}
+    derived_entry(const derived_entry&) = delete;
+    auto operator=(const derived_entry&) -> derived_entry& = delete;
+    virtual ~derived_entry() = default;
+};
+
+template <class R>
+struct derived_value final : derived_entry {
+    std::optional<R> _value;
+
+    using derived_entry::derived_entry;
+};
+
+template <class Tag, class R>
+inline constexpr char derived_key = 0;
+
+/*
+    The derived values of a model when the policy enables caching::derived; otherwise an empty
+    base. Each value is computed once: concurrent first uses wait for the one computing it.
+*/
+template <bool Cache>
+struct derived_cache {
+    void invalidate_derived() noexcept {}
+};
+
+template <>
+struct derived_cache<true> {
+    mutable std::atomic<derived_entry*> _derived{nullptr};
+
+    derived_cache() noexcept = default;
+    derived_cache(const derived_cache&) = delete;
+    auto operator=(const derived_cache&) -> derived_cache& = delete;
+    ~derived_cache() { invalidate_derived(); }
+
+    void invalidate_derived() noexcept {
+        derived_entry* p = _derived.exchange(nullptr, std::memory_order_acquire);
+        while (p) {
+            delete std::exchange(p, p->_next);
+        }
+    }
+
+    template <class R>
+    static auto find(derived_entry* p, const void* key) noexcept -> derived_value<R>* {
+        for (; p; p = p->_next) {
+            if (p->_key == key) return static_cast<derived_value<R>*>(p);
+        }
+        return nullptr;
+    }
+
+    template <class Tag, class T, class F>
+    auto derived(const T& x, F& f) const
+        -> const std::decay_t<std::invoke_result_t<F&, const T&>>& {
+        using result_type = std::decay_t<std::invoke_result_t<F&, const T&>>;
+        const void* key = &derived_key<Tag, result_type>;
+
+        derived_entry* head = _derived.load(std::memory_order_acquire);
+        derived_value<result_type>* entry = find<result_type>(head, key);
+        if (!entry) {
+            auto fresh = std::make_unique<derived_value<result_type>>(key);
+            do {
+                fresh->_next = head;
+                if (_derived.compare_exchange_weak(head, fresh.get(), std::memory_order_acq_rel,
+                                                   std::memory_order_acquire)) {
+                    entry = fresh.release();
+                    break;
+                }
+            } while (!(entry = find<result_type>(head, key)));
+        }
+
+        std::call_once(entry->_once, [&] { entry->_value.emplace(std::invoke(f, x)); });
+        return *entry->_value;
+    }
+};
+
+/*
+    The record of modifications of a model when the policy enables tracking::dirty_ranges;
+    otherwise an empty base.
+
+    Every state of a tracked value has a process wide unique stamp, renewed whenever the value is
+    modified in place. A model created by write_range() remembers the stamp of the value it was
+    copied from, and the element ranges modified since, merged and sorted. Any other modification
+    marks the whole value as changed.
+*/
+template <bool Track>
+struct dirty_log {
+    void invalidate_ranges() noexcept {}
+};
+
+/// Returns a process wide unique, nonzero stamp for a state of a value.
+inline auto next_stamp() noexcept -> std::uint64_t {
+    static std::atomic<std::uint64_t> stamp_s{0};
+    return stamp_s.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+template <>
+struct dirty_log<true> {
+    std::uint64_t _stamp{next_stamp()};
+    std::uint64_t _origin{0}; // the stamp of the value this was copied from, or zero
+    bool _all{true};          // true if the changes since _origin are not known
+    std::vector<std::pair<std::size_t, std::size_t>> _ranges;
+
+    void invalidate_ranges() noexcept {
+        _stamp = next_stamp();
+        _all = true;
+        _ranges.clear();
+    }
+
+    void derive_from(const dirty_log& origin) noexcept {
+        _origin = origin._stamp;
+        _all = false;
+    }
+
+    void record_range(std::size_t first, std::size_t last) noexcept {
+        _stamp = next_stamp();
+        if (_all || first == last) return;
+
+        auto p = std::lower_bound(_ranges.begin(), _ranges.end(), first,
+                                  [](const auto& r, std::size_t x) { return r.second < x; });
+        auto q = p;
+        while (q != _ranges.end() && q->first <= last) {
+            first = std::min(first, q->first);
+            last = std::max(last, q->second);
+            ++q;
+        }
+        if (p != q) {
+            *p = {first, last};
+            _ranges.erase(p + 1, q);
+            return;
+        }
+        try {
+            _ranges.insert(p, {first, last});
+        } catch (...) {
+            invalidate_ranges();
+        }
+    }
+};
+
+/*
+    The version of a model when the policy enables tracking::versioned; otherwise an empty base.
+    The version is a process wide unique stamp, renewed whenever the value is modified in place,
+    so it also distinguishes a model from an earlier one at the same address. It is only renewed
+    through a unique object, which no other thread can be reading.
+*/
+template <bool Track>
+struct version_stamp {
+    void renew_version() noexcept {}
+};
+
+template <>
+struct version_stamp<true> {
+    std::uint64_t _version{next_stamp()};
+
+    void renew_version() noexcept { _version = next_stamp(); }
+};
+
+/*
+    The mark on a model which has been published through an atomic_copy_on_write, when the policy
+    is reclaim::epoch; otherwise an empty base. Readers may borrow() a published value without a
+    reference, for as long as they stay pinned, so a marked model is never modified in place: a
+    write copies it, even through a unique handle obtained from exchange() or a later load().
+*/
+template <bool Epoch>
+struct publication_mark {
+    [[nodiscard]] auto published() const noexcept -> bool { return false; }
+    void mark_published() const noexcept {}
+};
+
+template <>
+struct publication_mark<true> {
+    mutable std::atomic<bool> _published{false};
+
+    [[nodiscard]] auto published() const noexcept -> bool {
+        return _published.load(std::memory_order_acquire);
+    }
+    void mark_published() const noexcept { _published.store(true, std::memory_order_release); }
+};
+
+/*
+    The state shared by a model and the weak handles to it, allocated when the first weak handle
+    is made. It holds one reference for the model and one for each weak handle. The model clears
+    `_target` under `_mutex` once its last strong reference is released, so a weak handle holding
+    `_mutex` which sees a target may safely try to take a reference on it.
+*/
+struct weak_anchor {
+    std::mutex _mutex;
+    std::atomic<void*> _target;
+    std::atomic<std::size_t> _count{1};
+
+    explicit weak_anchor(void* target) noexcept : _target(target) {}
+
+    void increment() noexcept { _count.fetch_add(1, std::memory_order_relaxed); }
+
+    void release() noexcept {
+        if (_count.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+};
+
+/*
+    The link from a model to its weak_anchor when the policy enables references::weak; otherwise
+    an empty base.
+*/
+template <bool Weak>
+struct weak_anchor_slot {
+    template <class Unique>
+    auto expire_observers(Unique) noexcept -> bool {
+        return true;
+    }
+    void expire_weak() noexcept {}
+};
+
+template <>
+struct weak_anchor_slot<true> {
+    mutable std::atomic<weak_anchor*> _anchor{nullptr};
+
+    /// Returns the anchor, creating it if needed, with a reference added for the caller.
+    auto acquire_anchor(void* target) const -> weak_anchor* {
+        weak_anchor* a = _anchor.load(std::memory_order_acquire);
+        if (!a) {
+            auto* fresh = new weak_anchor(target);
+            if (_anchor.compare_exchange_strong(a, fresh, std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                a = fresh;
+            } else {
+                delete fresh;
+            }
+        }
+        a->increment();
+        return a;
+    }
+
+    /// Returns true if a weak handle refers to the model.
+    [[nodiscard]] auto observed() const noexcept -> bool {
+        weak_anchor* a = _anchor.load(std::memory_order_acquire);
+        return a && a->_count.load(std::memory_order_acquire) > 1;
+    }
+
+    /*
+        Expires the weak handles to a model whose only strong reference is held by the caller, so
+        it may be modified in place. `unique()` is checked again under `_mutex`, and the result is
+        false if a weak handle took a reference first.
+    */
+    template <class Unique>
+    auto expire_observers(Unique unique) noexcept -> bool {
+        if (!observed()) return true;
+        weak_anchor* a = _anchor.load(std::memory_order_acquire);
+        {
+            std::lock_guard<std::mutex> lock(a->_mutex);
+            if (!unique()) return false;
+            a->_target.store(nullptr, std::memory_order_release);
+        }
+        _anchor.store(nullptr, std::memory_order_release);
+        a->release();
+        return true;
+    }
+
+    /// Called once the last strong reference is released, before the model is reclaimed.
+    void expire_weak() noexcept {
+        weak_anchor* a = _anchor.load(std::memory_order_acquire);
+        if (!a) return;
+        {
+            std::lock_guard<std::mutex> lock(a->_mutex);
+            a->_target.store(nullptr, std::memory_order_release);
+        }
+        a->release();
+    }
+};
+
+template <class T, class Policy, class = void>
+struct copy_on_write_hash;
+
+} // namespace detail
+
+/**************************************************************************************************/
+
+/*!
+    Reference counting policies for stlab::copy_on_write.
+
+    A policy provides a nested `counter` class used as the reference count of the shared model.
+    Other options are layered on top of a threading policy with adaptors.
+*/
+namespace threading {
+
+/*!
+    The default policy. Reference counts are atomic so copies sharing a value may be used from
+    different threads.
+*/
+struct multi : detail::policy_defaults {
+    class counter {
+        std::atomic<std::size_t> _count;
+
+    public:
+        explicit counter(std::size_t n) noexcept : _count{n} {}
+
+        void increment() noexcept { _count.fetch_add(1, std::memory_order_relaxed); }
+
+        void add(std::size_t n) noexcept { _count.fetch_add(n, std::memory_order_relaxed); }
+
+        /// Adds a reference unless the count is zero, returning true if it did.
+        [[nodiscard]] auto try_increment() noexcept -> bool {
+            std::size_t n = _count.load(std::memory_order_relaxed);
+            do {
+                if (n == 0) return false;
+            } while (!_count.compare_exchange_weak(n, n + 1, std::memory_order_relaxed));
+            return true;
+        }
+
+        /// Returns true if the last reference was released.
+        [[nodiscard]] auto decrement() noexcept -> bool { return release(1); }
+
+        /// Releases `n` references. Returns true if they were the last.
+        [[nodiscard]] auto release(std::size_t n) noexcept -> bool {
+            if (_count.fetch_sub(n, std::memory_order_release) != n) return false;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return true;
+        }
+
+        [[nodiscard]] auto load() const noexcept -> std::size_t {
+            return _count.load(std::memory_order_acquire);
+        }
+    };
+};
+
+/*!
+    A policy for values which are never shared across threads. Reference counts are plain integers,
+    avoiding the cost of atomic operations. Copies sharing a value must not be used concurrently
+    from different threads.
+*/
+struct single : detail::policy_defaults {
+    class counter {
+        std::size_t _count;
+
+    public:
+        explicit counter(std::size_t n) noexcept : _count{n} {}
+
+        void increment() noexcept { ++_count; }
+
+        void add(std::size_t n) noexcept { _count += n; }
+
+        /// Adds a reference unless the count is zero, returning true if it did.
+        [[nodiscard]] auto try_increment() noexcept -> bool {
+            if (_count == 0) return false;
+            ++_count;
+            return true;
+        }
+
+        /// Returns true if the last reference was released.
+        [[nodiscard]] auto decrement() noexcept -> bool { return --_count == 0; }
+
+        /// Releases `n` references. Returns true if they were the last.
+        [[nodiscard]] auto release(std::size_t n) noexcept -> bool { return (_count -= n) == 0; }
+
+        [[nodiscard]] auto load() const noexcept -> std::size_t { return _count; }
+    };
+};
+
+} // namespace threading
+
+/**************************************************************************************************/
+
+/*!
+    Layout policies for stlab::copy_on_write.
+*/
+namespace layout {
+
+/*!
+    Places the wrapped value at an `Alignment` boundary, so the reference count and the value are
+    on separate cache lines. Threads reading a shared value then do not suffer false sharing with
+    threads copying or destroying handles to it, at the cost of a larger model.
+
+    `Alignment` defaults to 64, which is `std::hardware_destructive_interference_size` on common
+    platforms.
+*/
+template <class Base = threading::multi, std::size_t Alignment = 64>
+struct padded : Base {
+    static constexpr std::size_t value_alignment = Alignment;
+};
+
+} // namespace layout
+
+/**************************************************************************************************/
+
+/*!
+    Hashing policies for stlab::copy_on_write.
+*/
+namespace hashing {
+
+/*!
+    Caches the hash of the shared value in the model. `std::hash<copy_on_write<T, Policy>>`
+    computes the hash with `std::hash<T>` the first time it is needed, after which every copy
+    sharing the value reuses it. The cache is cleared by write() and by assignment of a value to a
+    unique object, so the reference returned by write() must not be used to modify the value after
+    the object has been hashed. Values stored inline are not cached.
+*/
+template <class Base = threading::multi>
+struct cached : Base {
+    static constexpr bool cache_hash = true;
+};
+
+} // namespace hashing
+
+/**************************************************************************************************/
+
+/*!
+    Caching policies for stlab::copy_on_write.
+*/
+namespace caching {
+
+/*!
+    Allows copy_on_write::derived(), which caches values computed from the shared value, such as
+    sizes, bounding boxes or checksums, in the model. Each is computed once for all copies sharing
+    the value, even when they are used from many threads at once. The cache is cleared by write()
+    and by assignment of a value to a unique object, and a copy made by a write starts with an
+    empty cache. Each model has one extra word, and each cached value is a separate allocation.
+*/
+template <class Base = threading::multi>
+struct derived : Base {
+    static constexpr bool cache_derived = true;
+};
+
+} // namespace caching
+
+/**************************************************************************************************/
+
+/*!
+    Modification tracking policies for stlab::copy_on_write.
+*/
+namespace tracking {
+
+/*!
+    Records which elements of a contiguous container, such as `std::vector`, are modified through
+    copy_on_write::write_range(), so copy_on_write::delta() can list the elements changed between
+    a value and its copy without comparing them. Each model holds a stamp, the stamp of the value
+    it was copied from, and the modified ranges.
+*/
+template <class Base = threading::multi>
+struct dirty_ranges : Base {
+    static constexpr bool track_dirty = true;
+};
+
+/*!
+    Allows copy_on_write::version(), which identifies the state of a value so an observer can
+    detect any change, including a modification in place of a unique value, with one comparison.
+    Each model holds a stamp, which write(), write_range() and assignment of a value to a unique
+    object renew from a process wide atomic counter.
+*/
+template <class Base = threading::multi>
+struct versioned : Base {
+    static constexpr bool track_version = true;
+};
+
+} // namespace tracking
+
+/**************************************************************************************************/
+
+/*!
+    Reference policies for stlab::copy_on_write.
+*/
+namespace references {
+
+/*!
+    Allows weak_copy_on_write handles, which refer to a value without keeping it alive. Each model
+    has one extra word, pointing to state shared with its weak handles, which is allocated when the
+    first weak handle is made.
+
+    A value which a weak handle refers to is never modified in place, so a weak handle always
+    observes the value it was made from. A write through the only strong handle expires the weak
+    handles and then modifies the value in place; a shared value is copied as usual.
+*/
+template <class Base = threading::multi>
+struct weak : Base {
+    static constexpr bool weak_references = true;
+};
+
+} // namespace references
+
+/**************************************************************************************************/
+
+/*!
+    Instrumentation of stlab::copy_on_write, enabled by defining
+    `STLAB_COPY_ON_WRITE_INSTRUMENTATION` to 1.
+
+    Counts are kept per element type, independent of the policy, and are updated with relaxed
+    atomic operations.
+*/
+namespace instrumentation {
+
+/*!
+    The operations which are counted.
+*/
+enum class event {
+    allocation,         ///< a model was allocated
+    detach,             ///< write() copied a shared value
+    transform_detach,   ///< write(transform, inplace) transformed a shared value
+    inplace_write,      ///< a write did not need to copy
+    inplace_assignment, ///< operator=(U&&) assigned to a unique value
+};
+
+#if STLAB_COPY_ON_WRITE_INSTRUMENTATION
+
+/*!
+    A snapshot of the counts for an element type.
+*/
+struct statistics {
+    std::size_t allocations = 0;
+    std::size_t detaches = 0;
+    std::size_t transform_detaches = 0;
+    std::size_t inplace_writes = 0;
+    std::size_t inplace_assignments = 0;
+    std::size_t bytes_copied = 0; ///< the size of each detached value, by default_size_of
+};
+
+/*!
+    Describes a detach, passed to the detach hook.
+*/
+struct detach_info {
+    const std::type_info& type; ///< the element type
+    std::size_t size;           ///< the size of the detached value, by default_size_of
+    bool transform;             ///< true if from write(transform, inplace)
+};
+
+/*!
+    Called on the detaching thread for every detach, for example to sample a stack trace.
+*/
+using detach_hook = void (*)(const detach_info&) noexcept;
+
+namespace detail {
+
+struct counters {
+    std::atomic<std::size_t> _allocations{0};
+    std::atomic<std::size_t> _detaches{0};
+    std::atomic<std::size_t> _transform_detaches{0};
+    std::atomic<std::size_t> _inplace_writes{0};
+    std::atomic<std::size_t> _inplace_assignments{0};
+    std::atomic<std::size_t> _bytes_copied{0};
+};
+
+template <class T>
+inline counters counters_s;
+
+inline std::atomic<detach_hook> detach_hook_s{nullptr};
+
+template <class T>
+void record(event e, std::size_t bytes) noexcept {
+    counters& c = counters_s<T>;
+    switch (e) {
+        case event::allocation:
+            c._allocations.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case event::detach:
+        case event::transform_detach:
+            (e == event::detach ? c._detaches : c._transform_detaches)
+                .fetch_add(1, std::memory_order_relaxed);
+            c._bytes_copied.fetch_add(bytes, std::memory_order_relaxed);
+            if (auto hook = detach_hook_s.load(std::memory_order_acquire)) {
+                hook(detach_info{typeid(T), bytes, e == event::transform_detach});
+            }
+            break;
+        case event::inplace_write:
+            c._inplace_writes.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case event::inplace_assignment:
+            c._inplace_assignments.fetch_add(1, std::memory_order_relaxed);
+            break;
+    }
+}
+
+} // namespace detail
+
+/*!
+    @brief Returns the counts recorded for copy_on_write objects with element type `T`.
+*/
+template <class T>
+auto statistics_for() noexcept -> statistics {
+    const detail::counters& c = detail::counters_s<T>;
+    return {c._allocations.load(std::memory_order_relaxed),
+            c._detaches.load(std::memory_order_relaxed),
+            c._transform_detaches.load(std::memory_order_relaxed),
+            c._inplace_writes.load(std::memory_order_relaxed),
+            c._inplace_assignments.load(std::memory_order_relaxed),
+            c._bytes_copied.load(std::memory_order_relaxed)};
+}
+
+/*!
+    @brief Resets the counts recorded for element type `T` to zero.
+*/
+template <class T>
+void reset_statistics() noexcept {
+    detail::counters& c = detail::counters_s<T>;
+    c._allocations.store(0, std::memory_order_relaxed);
+    c._detaches.store(0, std::memory_order_relaxed);
+    c._transform_detaches.store(0, std::memory_order_relaxed);
+    c._inplace_writes.store(0, std::memory_order_relaxed);
+    c._inplace_assignments.store(0, std::memory_order_relaxed);
+    c._bytes_copied.store(0, std::memory_order_relaxed);
+}
+
+/*!
+    @brief Installs `hook` to be called on every detach, returning the previous hook. Pass
+   `nullptr` to remove it.
+*/
+inline auto set_detach_hook(detach_hook hook) noexcept -> detach_hook {
+    return detail::detach_hook_s.exchange(hook, std::memory_order_acq_rel);
+}
+
+#endif
+
+} // namespace instrumentation
 
 /**************************************************************************************************/
 
 /*!
-    The stlab namespace contains utilities and components for modern C++ development.
+    Storage policies for stlab::copy_on_write.
+
+    When a policy stores a value inline, the copy_on_write holds the value directly and copies it
+    eagerly instead of sharing it. The interface is unchanged: unique() is always true, identity()
+    is true only for the same object, and write() never copies. This lets generic code use
+    copy_on_write for every member while small members avoid a heap allocation and an indirection.
+*/
+namespace storage {
+
+/*!
+    Stores trivially copyable values of at most `Limit` bytes inline and shares all others.
+*/
+template <class Base = threading::multi, std::size_t Limit = 2 * sizeof(void*)>
+struct small_inline : Base {
+    template <class T>
+    static constexpr bool store_inline = (sizeof(T) <= Limit) && std::is_trivially_copyable_v<T>;
+};
+
+/*!
+    Stores all values inline.
+*/
+template <class Base = threading::multi>
+struct always_inline : Base {
+    template <class T>
+    static constexpr bool store_inline = true;
+};
+
+/*!
+    Allows values to live outside the model, such as in a memory mapped file or a deserialized
+    buffer, by constructing copy_on_write with `stlab::external`. Reading an external value does
+    not copy it, and the buffer is released when the last reference is. The first write copies the
+    value into an owned model, even if the object is unique, since the external value is treated
+    as read-only. Models refer to their value by pointer, so reads have an extra indirection.
+*/
+template <class Base = threading::multi>
+struct external : Base {
+    static constexpr bool external_values = true;
+};
+
+} // namespace storage
+
+/*!
+    Tag selecting the copy_on_write constructor for a value owned by someone else.
 */
-namespace stlab {
+struct external_t {
+    explicit external_t() = default;
+};
+
+/*!
+    Tag selecting the copy_on_write constructor for a value owned by someone else.
+*/
+inline constexpr external_t external{};
 
 /**************************************************************************************************/
 
+template <class T, class Policy>
+class atomic_copy_on_write;
+
+template <class T, class Policy>
+class weak_copy_on_write;
+
+template <typename T, typename Policy>
+class copy_on_write;
+
+namespace detail {
+
+template <class T, class Policy>
+auto detached_copy(copy_on_write<T, Policy>& x) -> std::optional<copy_on_write<T, Policy>>;
+
+template <class T, class Policy>
+auto writable(copy_on_write<T, Policy>& x) noexcept -> bool;
+
+} // namespace detail
+
+/*!
+    The state of a copy_on_write value, as returned by copy_on_write::version(): the identity of
+    its model and the model's version. A default constructed token matches no value.
+*/
+struct version_token {
+    const void* identity{nullptr};
+    std::uint64_t version{0};
+
+    friend inline auto operator==(const version_token& x, const version_token& y) noexcept
+        -> bool {
+        return x.identity == y.identity && x.version == y.version;
+    }
+
+    friend inline auto operator!=(const version_token& x, const version_token& y) noexcept
+        -> bool {
+        return !(x == y);
+    }
+};
+
 /*!
     A copy-on-write wrapper for any type that models Regular.
 
     Copy-on-write semantics allow for an object to be lazily copied - only creating a copy when
     the value is modified and there is more than one reference to the value.
 
-    This class is thread safe and supports types that model Moveable.
+    This class is thread safe and supports types that model Moveable. The reference counting
+    policy, `threading::multi` by default, may be replaced with `threading::single` for values that
+    never cross threads.
 */
-template <typename T> // T models Regular
+template <typename T, typename Policy = threading::multi> // T models Regular
 class copy_on_write {
-    struct model {
-        std::atomic<std::size_t> _count{1};
+    using counter_type = typename Policy::counter;
+
+    static constexpr std::size_t value_alignment =
+        Policy::value_alignment > alignof(T) ? Policy::value_alignment : alignof(T);
+
+    static constexpr bool is_external = Policy::external_values;
 
-        model() noexcept(std::is_nothrow_constructible_v<T>) = default;
+    static_assert(!(is_external && Policy::template store_inline<T>),
+                  "storage::external cannot be combined with inline storage");
+
+    template <bool External, class = void>
+    struct basic_model;
+
+    /// The model type, holding the value.
+    template <class Dummy>
+    struct basic_model<false, Dummy> : detail::hash_cache<Policy::cache_hash>,
+                                       detail::derived_cache<Policy::cache_derived>,
+                                       detail::dirty_log<Policy::track_dirty>,
+                                       detail::version_stamp<Policy::track_version>,
+                                       detail::weak_anchor_slot<Policy::weak_references>,
+                                       detail::publication_mark<Policy::epoch_reclaimed> {
+        counter_type _count{1};
+
+        basic_model() noexcept(std::is_nothrow_constructible_v<T>) = default;
 
         template <class... Args>
-        explicit model(Args&&... args) noexcept(std::is_nothrow_constructible_v<T, Args&&...>) :
+        explicit basic_model(Args&&... args) noexcept(
+            std::is_nothrow_constructible_v<T, Args&&...>) :
             _value(std::forward<Args>(args)...) {}
 
+        basic_model(const basic_model&) = delete;
+        auto operator=(const basic_model&) -> basic_model& = delete;
+
+        virtual ~basic_model() = default;
+
+        /// Releases the model, returning the storage to wherever it was obtained from.
+        virtual void destroy() noexcept { delete this; }
+
+        /// Creates a new model, from the same source of storage as this one, holding `x`.
+        [[nodiscard]] virtual auto clone(const T& x) const -> basic_model* {
+            return new basic_model(x);
+        }
+        [[nodiscard]] virtual auto clone(T&& x) const -> basic_model* {
+            return new basic_model(std::move(x));
+        }
+
+        alignas(value_alignment) T _value;
+    };
+
+    /// The model type with storage::external, referring to a value held by a derived model or
+    /// externally.
+    template <class Dummy>
+    struct basic_model<true, Dummy> : detail::hash_cache<Policy::cache_hash>,
+                                      detail::derived_cache<Policy::cache_derived>,
+                                      detail::dirty_log<Policy::track_dirty>,
+                                      detail::version_stamp<Policy::track_version>,
+                                      detail::weak_anchor_slot<Policy::weak_references>,
+                                      detail::publication_mark<Policy::epoch_reclaimed> {
+        counter_type _count{1};
+        T* _value_pointer;
+        bool _owned; // false if the value is external and must not be modified
+
+        basic_model(T* value, bool owned) noexcept : _value_pointer(value), _owned(owned) {}
+
+        basic_model(const basic_model&) = delete;
+        auto operator=(const basic_model&) -> basic_model& = delete;
+
+        virtual ~basic_model() = default;
+
+        virtual void destroy() noexcept = 0;
+
+        [[nodiscard]] virtual auto clone(const T& x) const -> basic_model* = 0;
+        [[nodiscard]] virtual auto clone(T&& x) const -> basic_model* = 0;
+    };
+
+    using model = basic_model<is_external>;
+
+    /// With storage::external, a model holding its value.
+    struct owned_model : model {
+        alignas(value_alignment) T _value;
+
+        owned_model() noexcept(std::is_nothrow_constructible_v<T>) :
+            model(&_value, true), _value() {}
+
+        template <class... Args>
+        explicit owned_model(Args&&... args) noexcept(
+            std::is_nothrow_constructible_v<T, Args&&...>) :
+            model(&_value, true), _value(std::forward<Args>(args)...) {}
+
+        void destroy() noexcept override { delete this; }
+
+        [[nodiscard]] auto clone(const T& x) const -> model* override {
+            return new owned_model(x);
+        }
+        [[nodiscard]] auto clone(T&& x) const -> model* override {
+            return new owned_model(std::move(x));
+        }
+    };
+
+    /// The most derived type of models created from a value.
+    using value_model = std::conditional_t<is_external, owned_model, model>;
+
+    /// With storage::external, a model referring to an external value. Copies are owned models.
+    template <class Release>
+    struct external_model final : model {
+        Release _release;
+
+        external_model(const T& value, Release&& release) :
+            model(const_cast<T*>(&value), false), _release(std::move(release)) {}
+
+        void destroy() noexcept override {
+            Release release(std::move(_release));
+            delete this;
+            release();
+        }
+
+        [[nodiscard]] auto clone(const T& x) const -> model* override {
+            return new owned_model(x);
+        }
+        [[nodiscard]] auto clone(T&& x) const -> model* override {
+            return new owned_model(std::move(x));
+        }
+    };
+
+    static auto value(model* self) noexcept -> T& {
+        if constexpr (is_external) {
+            return *self->_value_pointer;
+        } else {
+            return self->_value;
+        }
+    }
+
+    static auto value(const model* self) noexcept -> const T& {
+        return value(const_cast<model*>(self));
+    }
+
+    template <class Alloc>
+    struct allocated_model final : value_model {
+        using alloc_type =
+            typename std::allocator_traits<Alloc>::template rebind_alloc<allocated_model>;
+        using alloc_traits = std::allocator_traits<alloc_type>;
+
+        alloc_type _alloc;
+
+        template <class... Args>
+        explicit allocated_model(const alloc_type& alloc, Args&&... args) :
+            value_model(std::forward<Args>(args)...), _alloc(alloc) {}
+
+        template <class... Args>
+        static auto make(const alloc_type& alloc, Args&&... args) -> allocated_model* {
+            alloc_type a(alloc);
+            allocated_model* p = alloc_traits::allocate(a, 1);
+            try {
+                // The model itself is not allocator-aware, so construct it directly rather than
+                // through the allocator to avoid uses-allocator construction.
+                ::new (static_cast<void*>(p)) allocated_model(a, std::forward<Args>(args)...);
+            } catch (...) {
+                alloc_traits::deallocate(a, p, 1);
+                throw;
+            }
+            return p;
+        }
+
+        void destroy() noexcept override {
+            alloc_type a(std::move(_alloc));
+            this->~allocated_model();
+            alloc_traits::deallocate(a, this, 1);
+        }
+
+        [[nodiscard]] auto clone(const T& x) const -> model* override { return make(_alloc, x); }
+        [[nodiscard]] auto clone(T&& x) const -> model* override {
+            return make(_alloc, std::move(x));
+        }
+    };
+
+    struct inline_model {
         T _value;
+
+        inline_model() noexcept(std::is_nothrow_constructible_v<T>) : _value() {}
+
+        template <class... Args>
+        explicit inline_model(std::in_place_t, Args&&... args) noexcept(
+            std::is_nothrow_constructible_v<T, Args&&...>) :
+            _value(std::forward<Args>(args)...) {}
     };
 
-    model* _self;
+    static constexpr bool is_inline = Policy::template store_inline<T>;
+
+    using storage_type = std::conditional_t<is_inline, inline_model, model*>;
+
+    /// Records `e`; for a detach, `source` is the value copied.
+    static void record([[maybe_unused]] instrumentation::event e,
+                       [[maybe_unused]] const T* source = nullptr) noexcept {
+#if STLAB_COPY_ON_WRITE_INSTRUMENTATION
+        instrumentation::detail::record<T>(e, source ? default_size_of<T>{}(*source) : 0);
+#endif
+    }
+
+    template <class... Args>
+    static auto make(Args&&... args) -> storage_type {
+        if constexpr (is_inline) {
+            return inline_model(std::in_place, std::forward<Args>(args)...);
+        } else {
+            record(instrumentation::event::allocation);
+            return new value_model(std::forward<Args>(args)...);
+        }
+    }
+
+    template <class Alloc, class... Args>
+    static auto make_allocated(const Alloc& alloc, Args&&... args) -> storage_type {
+        if constexpr (is_inline) {
+            return make(std::forward<Args>(args)...);
+        } else {
+            record(instrumentation::event::allocation);
+            return allocated_model<Alloc>::make(alloc, std::forward<Args>(args)...);
+        }
+    }
+
+    /// Returns a new model holding `x`, from the same source of storage as the current model.
+    template <class U>
+    auto clone(U&& x) const -> model* {
+        record(instrumentation::event::allocation);
+        return _self->clone(std::forward<U>(x));
+    }
+
+    static auto steal(storage_type& x) noexcept(!is_inline ||
+                                                std::is_nothrow_move_constructible_v<T>)
+        -> storage_type {
+        if constexpr (is_inline) {
+            return std::move(x);
+        } else {
+            return std::exchange(x, nullptr);
+        }
+    }
+
+    struct adopt_t {};
+
+    explicit copy_on_write(adopt_t, model* self) noexcept : _self(self) {}
+
+    storage_type _self;
 
     template <class U>
     using disable_copy = std::enable_if_t<!std::is_same_v<std::decay_t<U>, copy_on_write>>*;
 
+    template <class U>
+    using disable_tag = std::enable_if_t<!std::is_same_v<std::decay_t<U>, std::allocator_arg_t> &&
+                                         !std::is_same_v<std::decay_t<U>, external_t>>*;
+
     template <typename U>
     using disable_copy_assign =
         std::enable_if_t<!std::is_same_v<std::decay_t<U>, copy_on_write>, copy_on_write&>;
 
-    auto default_model() noexcept(std::is_nothrow_constructible_v<T>) -> model* {
-        static model default_s;
-        return &default_s;
+    /*
+        The default model is shared by all default constructed instances. It is immortal: it is
+        never destroyed and its count is never touched, so default construction and destruction do
+        not contend on a shared cache line. Its storage is constant initialized so it can be
+        identified without constructing it.
+    */
+    static auto default_storage() noexcept -> void* {
+        alignas(value_model) static unsigned char storage_s[sizeof(value_model)];
+        return storage_s;
+    }
+
+    static auto default_model() noexcept(std::is_nothrow_constructible_v<T>) -> model* {
+        static model* default_s = ::new (default_storage()) value_model();
+        return default_s;
+    }
+
+    static auto is_default(const model* self) noexcept -> bool {
+        return self == default_storage();
+    }
+
+    static void destroy_model(void* self) noexcept { static_cast<model*>(self)->destroy(); }
+
+    /// Returns true if the value may be modified in place. The weak handles to a value which
+    /// is otherwise writable are expired, since a value is not modified while they refer to it.
+    auto writable() noexcept -> bool {
+        if constexpr (is_inline) {
+            return true;
+        } else {
+            auto unique = [this] { return this->unique(); };
+            if constexpr (is_external) {
+                if (!_self->_owned) return false;
+            }
+            return unique() && !_self->published() && _self->expire_observers(unique);
+        }
+    }
+
+    /// Clears the values cached in, and the ranges recorded by, a model which is about to be
+    /// modified in place, and renews its version.
+    void invalidate_caches() noexcept {
+        _self->invalidate_hash();
+        _self->invalidate_derived();
+        _self->invalidate_ranges();
+        _self->renew_version();
+    }
+
+    /// Hands a model whose last reference was released to the policy to be destroyed.
+    static void retire(model* self) noexcept {
+        self->expire_weak();
+        Policy::reclaim(value(self), self, &destroy_model);
+    }
+
+    template <class, class, class>
+    friend struct detail::copy_on_write_hash;
+
+    template <class, class>
+    friend class atomic_copy_on_write;
+
+    template <class, class>
+    friend class weak_copy_on_write;
+
+    template <class U, class P>
+    friend auto detail::detached_copy(copy_on_write<U, P>& x)
+        -> std::optional<copy_on_write<U, P>>;
+
+    template <class U, class P>
+    friend auto detail::writable(copy_on_write<U, P>& x) noexcept -> bool;
+
+    auto hash() const -> std::size_t {
+        if constexpr (!is_inline && Policy::cache_hash) {
+            assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+
+            return _self->cached_hash(value(_self));
+        } else {
+            return std::hash<T>{}(read());
+        }
     }
 
 public:
@@ -168,61 +1275,164 @@ public:
         @brief Default constructs the wrapped value.
     */
     copy_on_write() noexcept(std::is_nothrow_constructible_v<T>) {
-        _self = default_model();
-
-        // coverity[useless_call]
-        _self->_count.fetch_add(1, std::memory_order_relaxed);
+        if constexpr (!is_inline) _self = default_model();
     }
 
     /*!
         @brief Constructs a new instance by forwarding arguments to the wrapped value constructor.
     */
     template <class U>
-    copy_on_write(U&& x, disable_copy<U> = nullptr) : _self(new model(std::forward<U>(x))) {}
+    copy_on_write(U&& x, disable_copy<U> = nullptr) : _self(make(std::forward<U>(x))) {}
 
     /*!
         @brief Constructs a new instance by forwarding multiple arguments to the wrapped value
        constructor.
     */
-    template <class U, class V, class... Args>
+    template <class U, class V, class... Args, disable_tag<U> = nullptr>
     copy_on_write(U&& x, V&& y, Args&&... args) :
-        _self(new model(std::forward<U>(x), std::forward<V>(y), std::forward<Args>(args)...)) {}
+        _self(make(std::forward<U>(x), std::forward<V>(y), std::forward<Args>(args)...)) {}
 
     /*!
-        @brief Copy constructor that shares the underlying data with the source object.
+        @brief Constructs a new instance, using `alloc` to obtain storage, by forwarding arguments
+       to the wrapped value constructor.
+
+        The allocator is retained and any copy made by a later write is allocated with it as well.
+        Works with any type meeting the Allocator requirements, including
+       `std::pmr::polymorphic_allocator`.
     */
-    copy_on_write(const copy_on_write& x) noexcept : _self(x._self) {
-        assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+    template <class Alloc, class... Args>
+    copy_on_write(std::allocator_arg_t, const Alloc& alloc, Args&&... args) :
+        _self(make_allocated(alloc, std::forward<Args>(args)...)) {}
+
+    /*!
+        @brief Constructs a new instance referring to `x`, which is owned elsewhere, without
+       copying it. Requires the storage::external policy.
+
+        `x` must remain valid and unmodified until `release()` is called, which happens once, when
+        the last reference to it is released; `release()` must not throw. If construction fails,
+        `release()` is called before the exception propagates. The first write() copies `x` into
+        an owned value.
+    */
+    template <class Release>
+    copy_on_write(external_t, const element_type& x, Release release) {
+        static_assert(is_external,
+                      "constructing from an external value requires storage::external");
+
+        record(instrumentation::event::allocation);
+        try {
+            _self = new external_model<Release>(x, std::move(release));
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
 
-        // coverity[useless_call]
-        _self->_count.fetch_add(1, std::memory_order_relaxed);
+    /*!
+        @brief Copy constructor that shares the underlying data with the source object.
+    */
+    copy_on_write(const copy_on_write& x) noexcept(!is_inline ||
+                                                   std::is_nothrow_copy_constructible_v<T>) :
+        _self(x._self) {
+        if constexpr (!is_inline) {
+            assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+
+            // coverity[useless_call]
+            if (!is_default(_self)) _self->_count.increment();
+        }
     }
 
     /*!
         @brief Move constructor that takes ownership of the source object's data.
     */
-    copy_on_write(copy_on_write&& x) noexcept : _self{std::exchange(x._self, nullptr)} {
-        assert(_self && "WARNING (sparent) : using a moved copy_on_write object");
+    copy_on_write(copy_on_write&& x) noexcept(!is_inline ||
+                                              std::is_nothrow_move_constructible_v<T>) :
+        _self{steal(x._self)} {
+        if constexpr (!is_inline) {
+            assert(_self && "WARNING (sparent) : using a moved copy_on_write object");
+        }
     }
 
     /*!
         @brief Destructor
     */
     ~copy_on_write() {
-        assert(!_self || ((_self->_count > 0) && "FATAL (sparent) : double delete"));
-        if (_self && (_self->_count.fetch_sub(1, std::memory_order_release) == 1)) {
-            std::atomic_thread_fence(std::memory_order_acquire);
-            if constexpr (std::is_default_constructible_v<element_type>) {
-                assert(_self != default_model());
+        if constexpr (!is_inline) {
+            if (!_self || is_default(_self)) return;
+            assert((_self->_count.load() > 0) && "FATAL (sparent) : double delete");
+            if (_self->_count.decrement()) retire(_self);
+        }
+    }
+
+    /*!
+        @brief Writes `n` copies of this object to `out`, adding the `n` references to the shared
+       value with a single operation, and returns the iterator past the last copy written.
+
+        If writing to `out` throws, the copies already written remain valid and the references
+        reserved for the others are released.
+
+        @code
+        std::vector<stlab::copy_on_write<document>> queue;
+        snapshot.share_n(std::back_inserter(queue), workers);
+        @endcode
+    */
+    template <class OutputIt>
+    auto share_n(OutputIt out, std::size_t n) const -> OutputIt {
+        if constexpr (is_inline) {
+            for (; n != 0; --n) {
+                *out = *this;
+                ++out;
+            }
+        } else {
+            assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+
+            if (n == 0) return out;
+            const bool counted = !is_default(_self);
+            if (counted) _self->_count.add(n);
+            std::size_t written = 0;
+            try {
+                for (; written != n; ++written) {
+                    // The copy releases its own reference if the assignment throws.
+                    *out = copy_on_write(adopt_t{}, _self);
+                    ++out;
+                }
+            } catch (...) {
+                if (counted && written + 1 != n) (void)_self->_count.release(n - written - 1);
+                throw;
+            }
+        }
+        return out;
+    }
+
+    /*!
+        @brief Releases the values of the objects in `[first, last)`, leaving them in the
+       moved-from state, in which they may only be destroyed or assigned to.
+
+        Consecutive objects sharing a value, such as those written by share_n(), release their
+        references with a single operation. Has no effect on values stored inline.
+    */
+    template <class ForwardIt>
+    static void release_range(ForwardIt first, ForwardIt last) noexcept {
+        if constexpr (!is_inline) {
+            while (first != last) {
+                model* self = std::exchange(first->_self, nullptr);
+                std::size_t n = 1;
+                for (++first; first != last && first->_self == self; ++first) {
+                    first->_self = nullptr;
+                    ++n;
+                }
+                if (!self || is_default(self)) continue;
+                assert((self->_count.load() >= n) && "FATAL (sparent) : double delete");
+                if (self->_count.release(n)) retire(self);
             }
-            delete _self;
         }
     }
 
     /*!
         @brief Copy assignment operator that shares the underlying data with the source object.
     */
-    auto operator=(const copy_on_write& x) noexcept -> copy_on_write& {
+    auto operator=(const copy_on_write& x) noexcept(!is_inline ||
+                                                    std::is_nothrow_copy_constructible_v<T>)
+        -> copy_on_write& {
         // self-assignment is not allowed to disable cert-oop54-cpp warning (and is likely a bug)
         assert(this != &x && "self-assignment is not allowed");
         return *this = copy_on_write(x);
@@ -231,7 +1441,9 @@ public:
     /*!
         @brief Move assignment operator that takes ownership of the source object's data.
     */
-    auto operator=(copy_on_write&& x) noexcept -> copy_on_write& {
+    auto operator=(copy_on_write&& x) noexcept(!is_inline ||
+                                               std::is_nothrow_move_constructible_v<T>)
+        -> copy_on_write& {
         auto tmp{std::move(x)};
         swap(*this, tmp);
         return *this;
@@ -243,12 +1455,22 @@ public:
     */
     template <class U>
     auto operator=(U&& x) -> disable_copy_assign<U> {
-        if (_self && unique()) {
-            _self->_value = std::forward<U>(x);
+        if constexpr (is_inline) {
+            record(instrumentation::event::inplace_assignment);
+            _self._value = std::forward<U>(x);
             return *this;
-        }
+        } else {
+            if (_self && writable()) {
+                record(instrumentation::event::inplace_assignment);
+                invalidate_caches();
+                value(_self) = std::forward<U>(x);
+                return *this;
+            }
 
-        return *this = copy_on_write(std::forward<U>(x));
+            if (!_self) return *this = copy_on_write(std::forward<U>(x));
+
+            return *this = copy_on_write(adopt_t{}, clone(element_type(std::forward<U>(x))));
+        }
     }
 
     /*! @addtogroup observers
@@ -261,9 +1483,20 @@ public:
         other copy_on_write objects sharing the same data.
     */
     auto write() -> element_type& {
-        if (!unique()) *this = copy_on_write(read());
+        if constexpr (is_inline) {
+            record(instrumentation::event::inplace_write);
+            return _self._value;
+        } else {
+            if (!writable()) {
+                record(instrumentation::event::detach, &read());
+                *this = copy_on_write(adopt_t{}, clone(read()));
+            } else {
+                record(instrumentation::event::inplace_write);
+                invalidate_caches();
+            }
 
-        return _self->_value;
+            return value(_self);
+        }
     }
 
     /*!
@@ -286,22 +1519,53 @@ public:
         static_assert(std::is_invocable_r_v<void, Inplace, T&>,
                       "Inplace must be invocable with T&");
 
-        if (!unique()) {
-            *this = copy_on_write(transform(read()));
+        if constexpr (is_inline) {
+            record(instrumentation::event::inplace_write);
+            inplace(_self._value);
+            return _self._value;
         } else {
-            inplace(_self->_value);
-        }
+            if (!writable()) {
+                record(instrumentation::event::transform_detach, &read());
+                *this = copy_on_write(adopt_t{}, clone(transform(read())));
+            } else {
+                record(instrumentation::event::inplace_write);
+                invalidate_caches();
+                inplace(value(_self));
+            }
 
-        return _self->_value;
+            return value(_self);
+        }
     }
 
     /*!
         @brief Returns a const reference to the underlying value for read-only access.
     */
     [[nodiscard]] auto read() const noexcept -> const element_type& {
-        assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+        if constexpr (is_inline) {
+            return _self._value;
+        } else {
+            assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+
+            return value(_self);
+        }
+    }
+
+    /*!
+        @brief Extracts the underlying value, leaving this object in the moved-from state.
+
+        If this is the only reference to the value it is moved out and the model is released,
+        otherwise the value is copied.
+    */
+    [[nodiscard]] auto take() && -> element_type {
+        if constexpr (is_inline) {
+            return std::move(_self._value);
+        } else {
+            assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
 
-        return _self->_value;
+            copy_on_write tmp(std::move(*this));
+            if (tmp.writable()) return std::move(value(tmp._self));
+            return value(tmp._self);
+        }
     }
 
     /*!
@@ -325,9 +1589,13 @@ public:
         This is useful to determine if calling write() will cause a copy.
     */
     [[nodiscard]] auto unique() const noexcept -> bool {
-        assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+        if constexpr (is_inline) {
+            return true;
+        } else {
+            assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
 
-        return _self->_count.load(std::memory_order_acquire) == 1;
+            return !is_default(_self) && (_self->_count.load() == 1);
+        }
     }
 
     /*!
@@ -340,9 +1608,114 @@ public:
         @brief Returns true if this object and the given object share the same underlying data.
     */
     [[nodiscard]] auto identity(const copy_on_write& x) const noexcept -> bool {
-        assert((_self && x._self) && "FATAL (sparent) : using a moved copy_on_write object");
+        if constexpr (is_inline) {
+            return this == &x;
+        } else {
+            assert((_self && x._self) && "FATAL (sparent) : using a moved copy_on_write object");
+
+            return _self == x._self;
+        }
+    }
+
+    /*!
+        @brief Returns a key identifying the underlying data. Two objects have equal keys if and
+       only if identity() is true for them, so the key can be used to deduplicate shared values.
+    */
+    [[nodiscard]] auto identity() const noexcept -> const void* {
+        if constexpr (is_inline) {
+            return &_self._value;
+        } else {
+            assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+
+            return _self;
+        }
+    }
+
+    /*!
+        @brief Returns `fn(read())`, computing it only the first time it is requested for the
+       shared value. Requires the caching::derived policy.
+
+        `Tag` names the projection; every call with the same `Tag` and result type must compute
+        the same thing. The reference is valid until the value is modified or destroyed.
+
+        @code
+        auto& box = shape.derived<struct bounds_tag>([](const polygon& p) { return bounds(p); });
+        @endcode
+    */
+    template <class Tag, class F>
+    auto derived(F&& fn) const -> const std::decay_t<std::invoke_result_t<F&, const T&>>& {
+        static_assert(Policy::cache_derived, "derived() requires the caching::derived policy");
+        static_assert(!is_inline, "derived() requires shared storage");
+        assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
+
+        return _self->template derived<Tag>(value(_self), fn);
+    }
+
+    /*!
+        @brief Obtains write access to the elements `[first, last)` of a contiguous container,
+       recording them as modified, and returns a pointer to the first of them. Requires the
+       tracking::dirty_ranges policy.
+
+        Only those elements may be modified through the pointer, and the container must not be
+        resized. A shared value is copied first, and the copy knows it came from the original.
+    */
+    template <class U = element_type>
+    auto write_range(std::size_t first, std::size_t last) -> decltype(std::declval<U&>().data()) {
+        static_assert(Policy::track_dirty,
+                      "write_range() requires the tracking::dirty_ranges policy");
+        static_assert(!is_inline, "write_range() requires shared storage");
+        assert(first <= last && last <= read().size() && "write_range() range out of bounds");
+
+        if (!writable()) {
+            record(instrumentation::event::detach, &read());
+            model* copy = clone(read());
+            copy->derive_from(*_self);
+            *this = copy_on_write(adopt_t{}, copy);
+        } else {
+            record(instrumentation::event::inplace_write);
+            _self->invalidate_hash();
+            _self->invalidate_derived();
+            _self->renew_version();
+        }
+        _self->record_range(first, last);
+        return value(_self).data() + first;
+    }
+
+    /*!
+        @brief Returns the element ranges `[first, last)` which differ between `from` and this
+       value, sorted and disjoint, or nothing if they are not known. Requires the
+       tracking::dirty_ranges policy.
+
+        The ranges are known if this value was copied from `from` by write_range(), and since
+        then has only been modified through write_range() while `from` has not been modified. The
+        result may include elements which were written with their previous value.
+    */
+    [[nodiscard]] auto delta(const copy_on_write& from) const
+        -> std::optional<std::vector<std::pair<std::size_t, std::size_t>>> {
+        static_assert(Policy::track_dirty, "delta() requires the tracking::dirty_ranges policy");
+        static_assert(!is_inline, "delta() requires shared storage");
+        assert((_self && from._self) && "FATAL (sparent) : using a moved copy_on_write object");
+
+        if (identity(from)) return std::vector<std::pair<std::size_t, std::size_t>>();
+        if (_self->_all || _self->_origin != from._self->_stamp) return std::nullopt;
+        return _self->_ranges;
+    }
+
+    /*!
+        @brief Returns a token identifying the current state of the value. Requires the
+       tracking::versioned policy.
+
+        Two tokens compare equal only if they were taken from the same state of the same value, so
+        an observer holding the token from its last visit can skip its work with one comparison.
+        A value modified in place, or replaced, yields a different token. A token does not keep
+        the value alive.
+    */
+    [[nodiscard]] auto version() const noexcept -> version_token {
+        static_assert(Policy::track_version, "version() requires the tracking::versioned policy");
+        static_assert(!is_inline, "version() requires shared storage");
+        assert(_self && "FATAL (sparent) : using a moved copy_on_write object");
 
-        return _self == x._self;
+        return {_self, _self->_version};
     }
 
     /*! @} */
@@ -354,7 +1727,8 @@ public:
     /*!
         @brief Efficiently swaps the contents of two copy_on_write objects.
     */
-    friend inline void swap(copy_on_write& x, copy_on_write& y) noexcept {
+    friend inline void swap(copy_on_write& x, copy_on_write& y) noexcept(
+        !is_inline || std::is_nothrow_swappable_v<T>) {
         std::swap(x._self, y._self);
     }
 
@@ -438,10 +1812,106 @@ public:
 };
 /**************************************************************************************************/
 
+/*!
+    @addtogroup non_member_functions
+    @{ */
+/*!
+    @brief Constructs a `copy_on_write<T, Policy>` whose storage is obtained from `alloc`, in the
+   manner of `std::allocate_shared`.
+
+    The allocator is type-erased in the result; copies made by write operations are allocated with
+    the same allocator. To use a `std::pmr::memory_resource`, pass a
+    `std::pmr::polymorphic_allocator` referring to it.
+*/
+template <class T, class Policy = threading::multi, class Alloc, class... Args>
+auto allocate_copy_on_write(const Alloc& alloc, Args&&... args) -> copy_on_write<T, Policy> {
+    return copy_on_write<T, Policy>(std::allocator_arg, alloc, std::forward<Args>(args)...);
+}
+
+namespace detail {
+
+/// Returns true if a write through `x` modifies its value in place, as `x.write()` decides.
+template <class T, class Policy>
+auto writable(copy_on_write<T, Policy>& x) noexcept -> bool {
+    return x.writable();
+}
+
+template <class T, class Policy>
+auto detached_copy(copy_on_write<T, Policy>& x) -> std::optional<copy_on_write<T, Policy>> {
+    std::optional<copy_on_write<T, Policy>> result;
+    if (!x.writable()) {
+        result.emplace(x);
+        (void)result->write();
+    }
+    return result;
+}
+
+} // namespace detail
+
+/*!
+    @brief Obtains write access to several copy_on_write objects as a single transaction and
+   returns a tuple of references to their values.
+
+    Every argument whose write would copy, because it is shared or otherwise may not be modified
+    in place, is copied before any argument is modified. If a copy throws, the arguments are
+    unchanged (strong guarantee); otherwise the copies are installed with non-throwing swaps.
+    Other arguments are not copied.
+
+    @code
+    auto [header, body] = stlab::write_all(doc._header, doc._body);
+    @endcode
+*/
+template <class... T, class... Policy>
+auto write_all(copy_on_write<T, Policy>&... x) -> std::tuple<T&...> {
+    std::tuple<std::optional<copy_on_write<T, Policy>>...> detached{detail::detached_copy(x)...};
+    std::apply(
+        [&](auto&... copy) {
+            (..., (copy ? swap(x, *copy) : void()));
+        },
+        detached);
+    return std::tuple<T&...>(x.write()...);
+}
+/*! @} */
+
+/**************************************************************************************************/
+
+namespace detail {
+
+// Disabled, in the manner of std::hash, when std::hash<T> is disabled.
+template <class T, class Policy, class>
+struct copy_on_write_hash {
+    copy_on_write_hash() = delete;
+    copy_on_write_hash(const copy_on_write_hash&) = delete;
+    auto operator=(const copy_on_write_hash&) -> copy_on_write_hash& = delete;
+};
+
+template <class T, class Policy>
+struct copy_on_write_hash<T, Policy,
+                          std::enable_if_t<std::is_default_constructible_v<std::hash<T>>>> {
+    auto operator()(const copy_on_write<T, Policy>& x) const -> std::size_t { return x.hash(); }
+};
+
+} // namespace detail
+
+/**************************************************************************************************/
+
 } // namespace stlab
 
 /**************************************************************************************************/
 
+namespace std {
+
+/*!
+    Hashes the underlying value with `std::hash<T>`, so it agrees with hashing the value itself.
+    With the hashing::cached policy the hash is computed once per shared value.
+*/
+template <class T, class Policy>
+struct hash<stlab::copy_on_write<T, Policy>> : stlab::detail::copy_on_write_hash<T, Policy> {};
+
+} // namespace std
+
+/**************************************************************************************************/
+
 #endif
 
 /**************************************************************************************************/
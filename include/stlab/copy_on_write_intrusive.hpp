@@ -0,0 +1,356 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file copy_on_write_intrusive.hpp
+    @brief Copy-on-write wrapper for types which embed their own reference count
+
+    This file contains stlab::copy_on_write_intrusive, a copy-on-write handle which points
+    directly at the value and manages its lifetime through reference counting hooks found by
+    argument dependent lookup, and stlab::intrusive_cow_counter, a base class providing the hooks.
+*/
+
+#ifndef STLAB_COPY_ON_WRITE_INTRUSIVE_HPP
+#define STLAB_COPY_ON_WRITE_INTRUSIVE_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    A base class which embeds a reference count in `Derived` and provides the hooks used by
+    copy_on_write_intrusive. `Policy` is a threading policy supplying the counter.
+
+    The count is not copied or assigned with the derived object, so a copy made by a detaching
+    write starts unreferenced.
+*/
+template <class Derived, class Policy = threading::multi>
+class intrusive_cow_counter {
+    mutable typename Policy::counter _count{0};
+
+    static auto counter(const Derived* p) noexcept -> typename Policy::counter& {
+        return static_cast<const intrusive_cow_counter*>(p)->_count;
+    }
+
+    friend void intrusive_cow_add_ref(const Derived* p) noexcept { counter(p).increment(); }
+
+    friend void intrusive_cow_release(const Derived* p) noexcept {
+        if (counter(p).decrement()) delete p;
+    }
+
+    friend auto intrusive_cow_use_count(const Derived* p) noexcept -> std::size_t {
+        return counter(p).load();
+    }
+
+protected:
+    intrusive_cow_counter() noexcept = default;
+    intrusive_cow_counter(const intrusive_cow_counter&) noexcept {}
+    auto operator=(const intrusive_cow_counter&) noexcept -> intrusive_cow_counter& {
+        return *this;
+    }
+    ~intrusive_cow_counter() = default;
+};
+
+/**************************************************************************************************/
+
+/*!
+    A copy-on-write handle for a type which embeds its own reference count, with the same
+    semantics as copy_on_write.
+
+    The handle is a single pointer to the value; there is no separate model, which saves the
+    model's header per value and means a handle can be recovered from a `const T*`, such as one
+    passed through a C callback, without a lookup table.
+
+    The reference count is managed with these functions, found by argument dependent lookup:
+
+    - `void intrusive_cow_add_ref(const T*) noexcept` adds a reference.
+    - `void intrusive_cow_release(const T*) noexcept` removes a reference, deleting the value when
+      it was the last.
+    - `std::size_t intrusive_cow_use_count(const T*) noexcept` returns the number of references.
+
+    Deriving `T` from intrusive_cow_counter<T> provides them. Values are created with `new`, and
+    copying `T` must not copy its reference count.
+*/
+template <class T>
+class copy_on_write_intrusive {
+    T* _self;
+
+    template <class U>
+    using disable_copy =
+        std::enable_if_t<!std::is_same_v<std::decay_t<U>, copy_on_write_intrusive>>*;
+
+    template <typename U>
+    using disable_copy_assign =
+        std::enable_if_t<!std::is_same_v<std::decay_t<U>, copy_on_write_intrusive>,
+                         copy_on_write_intrusive&>;
+
+    template <class... Args>
+    static auto make(Args&&... args) -> T* {
+        T* p = new T(std::forward<Args>(args)...);
+        intrusive_cow_add_ref(p);
+        return p;
+    }
+
+    /*
+        Default constructed instances share one value, which holds a reference of its own so it
+        is never destroyed.
+    */
+    static auto default_value() -> T* {
+        static T* default_s = make();
+        return default_s;
+    }
+
+    void reset(T* p) noexcept {
+        T* old = std::exchange(_self, p);
+        if (old) intrusive_cow_release(old);
+    }
+
+public:
+    /*! @addtogroup member_types
+    @{ */
+    /*!
+        @brief The type of value stored
+    */
+    using element_type = T;
+    /*! @} */
+
+    /*! @addtogroup member_functions
+    @{ */
+    /*!
+        @brief Refers to a shared default constructed value.
+    */
+    copy_on_write_intrusive() : _self(default_value()) { intrusive_cow_add_ref(_self); }
+
+    /*!
+        @brief Constructs a new value by forwarding the argument to its constructor.
+    */
+    template <class U>
+    copy_on_write_intrusive(U&& x, disable_copy<U> = nullptr) : _self(make(std::forward<U>(x))) {}
+
+    /*!
+        @brief Constructs a new value by forwarding multiple arguments to its constructor.
+    */
+    template <class U, class V, class... Args>
+    copy_on_write_intrusive(U&& x, V&& y, Args&&... args) :
+        _self(make(std::forward<U>(x), std::forward<V>(y), std::forward<Args>(args)...)) {}
+
+    /*!
+        @brief Recovers a handle from a pointer obtained from get(), adding a reference.
+    */
+    static auto from_pointer(const T* p) noexcept -> copy_on_write_intrusive {
+        assert(p && "copy_on_write_intrusive::from_pointer requires a value");
+        intrusive_cow_add_ref(p);
+        return copy_on_write_intrusive(const_cast<T*>(p), adopt_t{});
+    }
+
+    /*!
+        @brief Recovers a handle from a pointer obtained from release(), taking over its
+       reference.
+    */
+    static auto adopt_pointer(const T* p) noexcept -> copy_on_write_intrusive {
+        assert(p && "copy_on_write_intrusive::adopt_pointer requires a value");
+        return copy_on_write_intrusive(const_cast<T*>(p), adopt_t{});
+    }
+
+    copy_on_write_intrusive(const copy_on_write_intrusive& x) noexcept : _self(x._self) {
+        assert(_self && "FATAL (sparent) : using a moved copy_on_write_intrusive object");
+        intrusive_cow_add_ref(_self);
+    }
+
+    copy_on_write_intrusive(copy_on_write_intrusive&& x) noexcept :
+        _self(std::exchange(x._self, nullptr)) {}
+
+    ~copy_on_write_intrusive() {
+        if (_self) intrusive_cow_release(_self);
+    }
+
+    auto operator=(const copy_on_write_intrusive& x) noexcept -> copy_on_write_intrusive& {
+        assert(this != &x && "self-assignment is not allowed");
+        return *this = copy_on_write_intrusive(x);
+    }
+
+    auto operator=(copy_on_write_intrusive&& x) noexcept -> copy_on_write_intrusive& {
+        auto tmp{std::move(x)};
+        swap(*this, tmp);
+        return *this;
+    }
+
+    /*!
+        @brief Assigns a new value, in place when unique.
+    */
+    template <class U>
+    auto operator=(U&& x) -> disable_copy_assign<U> {
+        if (_self && unique()) {
+            *_self = std::forward<U>(x);
+            return *this;
+        }
+        reset(make(std::forward<U>(x)));
+        return *this;
+    }
+
+    /*! @addtogroup observers
+    @{ */
+
+    /*!
+        @brief Obtains a non-const reference to the value, copying it first if it is shared.
+    */
+    auto write() -> element_type& {
+        if (!unique()) reset(make(read()));
+        return *_self;
+    }
+
+    /*!
+        @brief If the value is shared, replaces it with `transform(read())`, otherwise calls
+       `inplace` with a reference to it. Returns a reference to the value.
+    */
+    template <class Transform, class Inplace>
+    auto write(Transform transform, Inplace inplace) -> element_type& {
+        static_assert(std::is_invocable_r_v<T, Transform, const T&>,
+                      "Transform must be invocable with const T&");
+        static_assert(std::is_invocable_r_v<void, Inplace, T&>,
+                      "Inplace must be invocable with T&");
+
+        if (!unique()) {
+            reset(make(transform(read())));
+        } else {
+            inplace(*_self);
+        }
+        return *_self;
+    }
+
+    [[nodiscard]] auto read() const noexcept -> const element_type& {
+        assert(_self && "FATAL (sparent) : using a moved copy_on_write_intrusive object");
+        return *_self;
+    }
+
+    /*!
+        @brief Extracts the value, leaving this object in the moved-from state. The value is moved
+       out if unique and copied otherwise.
+    */
+    [[nodiscard]] auto take() && -> element_type {
+        copy_on_write_intrusive tmp(std::move(*this));
+        if (tmp.unique()) return std::move(*tmp._self);
+        return *tmp._self;
+    }
+
+    operator const element_type&() const noexcept { return read(); }
+    auto operator*() const noexcept -> const element_type& { return read(); }
+    auto operator->() const noexcept -> const element_type* { return &read(); }
+
+    /*!
+        @brief Returns a pointer to the value, from which from_pointer() can recover a handle
+       while this one exists.
+    */
+    [[nodiscard]] auto get() const noexcept -> const element_type* { return _self; }
+
+    /*!
+        @brief Returns a pointer to the value, transferring this object's reference to the caller
+       and leaving this object in the moved-from state. Pass it to adopt_pointer() to recover the
+       handle.
+    */
+    [[nodiscard]] auto release() noexcept -> const element_type* {
+        return std::exchange(_self, nullptr);
+    }
+
+    [[nodiscard]] auto unique() const noexcept -> bool {
+        assert(_self && "FATAL (sparent) : using a moved copy_on_write_intrusive object");
+        return intrusive_cow_use_count(_self) == 1;
+    }
+
+    [[nodiscard]] auto identity(const copy_on_write_intrusive& x) const noexcept -> bool {
+        return _self == x._self;
+    }
+
+    [[nodiscard]] auto identity() const noexcept -> const void* { return _self; }
+
+    /*! @} */
+    /*! @} */
+
+    /*!
+        @addtogroup non_member_functions
+        @{ */
+    friend inline void swap(copy_on_write_intrusive& x, copy_on_write_intrusive& y) noexcept {
+        std::swap(x._self, y._self);
+    }
+
+    friend inline auto operator==(const copy_on_write_intrusive& x,
+                                  const copy_on_write_intrusive& y) noexcept -> bool {
+        return x.identity(y) || (*x == *y);
+    }
+
+    friend inline auto operator==(const copy_on_write_intrusive& x, const element_type& y) noexcept
+        -> bool {
+        return *x == y;
+    }
+
+    friend inline auto operator==(const element_type& x, const copy_on_write_intrusive& y) noexcept
+        -> bool {
+        return x == *y;
+    }
+
+    friend inline auto operator!=(const copy_on_write_intrusive& x,
+                                  const copy_on_write_intrusive& y) noexcept -> bool {
+        return !(x == y);
+    }
+
+    friend inline auto operator!=(const copy_on_write_intrusive& x, const element_type& y) noexcept
+        -> bool {
+        return !(x == y);
+    }
+
+    friend inline auto operator!=(const element_type& x, const copy_on_write_intrusive& y) noexcept
+        -> bool {
+        return !(x == y);
+    }
+
+    friend inline auto operator<(const copy_on_write_intrusive& x,
+                                 const copy_on_write_intrusive& y) noexcept -> bool {
+        return !x.identity(y) && (*x < *y);
+    }
+
+    friend inline auto operator>(const copy_on_write_intrusive& x,
+                                 const copy_on_write_intrusive& y) noexcept -> bool {
+        return y < x;
+    }
+
+    friend inline auto operator<=(const copy_on_write_intrusive& x,
+                                  const copy_on_write_intrusive& y) noexcept -> bool {
+        return !(y < x);
+    }
+
+    friend inline auto operator>=(const copy_on_write_intrusive& x,
+                                  const copy_on_write_intrusive& y) noexcept -> bool {
+        return !(x < y);
+    }
+    /*! @} */
+
+private:
+    struct adopt_t {};
+
+    copy_on_write_intrusive(T* p, adopt_t) noexcept : _self(p) {}
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -0,0 +1,498 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file cow_map.hpp
+    @brief Persistent hash map with structural sharing built on copy_on_write
+
+    This file contains stlab::cow_map, a hash array mapped trie whose nodes are copy_on_write
+    values, so modifying a shared map copies only the nodes on the path to the modified entry.
+*/
+
+#ifndef STLAB_COW_MAP_HPP
+#define STLAB_COW_MAP_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    An unordered associative container with value semantics, implemented as a hash array mapped
+    trie.
+
+    Each node of the trie is a copy_on_write value holding a 32-way bitmap of inline entries and a
+    32-way bitmap of child nodes (the CHAMP layout). Copying a cow_map is O(1). Inserting into or
+    erasing from a shared map copies only the O(log n) nodes on the path to the entry; the rest of
+    the trie remains shared between the copies. Keys whose hashes are equal in all bits are kept in a
+    collision node at the bottom of the trie.
+
+    Nodes are kept in canonical form, so maps holding the same entries have the same shape and
+    equality skips any subtrees the maps share.
+*/
+template <class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+class cow_map {
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using const_reference = const value_type&;
+
+private:
+    static constexpr unsigned bits_per_level = 5;
+    static constexpr unsigned hash_bits = std::numeric_limits<std::size_t>::digits;
+    static constexpr std::size_t max_depth = hash_bits / bits_per_level + 2;
+
+    struct node;
+    using node_ptr = copy_on_write<node>;
+
+    struct node {
+        std::uint32_t _datamap{0};     // slots holding an entry
+        std::uint32_t _nodemap{0};     // slots holding a child node
+        std::vector<value_type> _values; // ordered by slot
+        std::vector<node_ptr> _children; // ordered by slot
+
+        friend auto operator==(const node& x, const node& y) -> bool {
+            if (x._datamap != y._datamap || x._nodemap != y._nodemap) return false;
+            if (x._values.size() != y._values.size()) return false;
+            // Entries in a collision node are unordered.
+            if (x._datamap == 0 && x._nodemap == 0) {
+                return std::is_permutation(x._values.begin(), x._values.end(),
+                                           y._values.begin());
+            }
+            return x._values == y._values && x._children == y._children;
+        }
+
+        friend auto operator!=(const node& x, const node& y) -> bool { return !(x == y); }
+    };
+
+    node_ptr _root;
+    size_type _size{0};
+    Hash _hash;
+    KeyEqual _equal;
+
+    static auto popcount(std::uint32_t x) noexcept -> std::size_t {
+        x = x - ((x >> 1) & 0x55555555u);
+        x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+        return (((x + (x >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+    }
+
+    static auto is_collision(unsigned shift) noexcept -> bool { return shift >= hash_bits; }
+
+    static auto bit(std::size_t hash, unsigned shift) noexcept -> std::uint32_t {
+        return std::uint32_t{1} << ((hash >> shift) & 31u);
+    }
+
+    static auto index(std::uint32_t map, std::uint32_t bit) noexcept -> std::size_t {
+        return popcount(map & (bit - 1));
+    }
+
+    auto hash(const K& key) const -> std::size_t { return _hash(key); }
+
+    auto find_collision(const node& n, const K& key) const -> std::size_t {
+        for (std::size_t i = 0; i != n._values.size(); ++i) {
+            if (_equal(n._values[i].first, key)) return i;
+        }
+        return n._values.size();
+    }
+
+    /// Creates the subtree holding both `a` and `b`, which are in the same slot at `shift - 5`.
+    auto make_pair_node(value_type a, std::size_t ha, value_type b, std::size_t hb,
+                        unsigned shift) const -> node_ptr {
+        node n;
+        if (is_collision(shift)) {
+            n._values.push_back(std::move(a));
+            n._values.push_back(std::move(b));
+            return node_ptr(std::move(n));
+        }
+        std::uint32_t bit_a = bit(ha, shift);
+        std::uint32_t bit_b = bit(hb, shift);
+        if (bit_a == bit_b) {
+            n._nodemap = bit_a;
+            n._children.push_back(
+                make_pair_node(std::move(a), ha, std::move(b), hb, shift + bits_per_level));
+        } else {
+            n._datamap = bit_a | bit_b;
+            if (bit_a < bit_b) {
+                n._values.push_back(std::move(a));
+                n._values.push_back(std::move(b));
+            } else {
+                n._values.push_back(std::move(b));
+                n._values.push_back(std::move(a));
+            }
+        }
+        return node_ptr(std::move(n));
+    }
+
+    /// Returns true if a new entry was added; otherwise assigns the mapped value if `assign`.
+    template <class M>
+    auto insert(node_ptr& self, std::size_t h, unsigned shift, const K& key, M&& mapped,
+                bool assign) -> bool {
+        if (is_collision(shift)) {
+            std::size_t i = find_collision(*self, key);
+            if (i != self->_values.size()) {
+                if (assign) self.write()._values[i].second = std::forward<M>(mapped);
+                return false;
+            }
+            self.write()._values.emplace_back(key, std::forward<M>(mapped));
+            return true;
+        }
+
+        std::uint32_t b = bit(h, shift);
+        if (self->_datamap & b) {
+            std::size_t i = index(self->_datamap, b);
+            const value_type& existing = self->_values[i];
+            if (_equal(existing.first, key)) {
+                if (assign) self.write()._values[i].second = std::forward<M>(mapped);
+                return false;
+            }
+            node_ptr child = make_pair_node(existing, hash(existing.first),
+                                            value_type(key, std::forward<M>(mapped)), h,
+                                            shift + bits_per_level);
+            node& n = self.write();
+            // Reserve first, so nothing can throw once the entry is erased.
+            n._children.reserve(n._children.size() + 1);
+            n._values.erase(n._values.begin() + static_cast<difference_type>(i));
+            n._datamap &= ~b;
+            n._children.insert(n._children.begin() +
+                                   static_cast<difference_type>(index(n._nodemap, b)),
+                               std::move(child));
+            n._nodemap |= b;
+            return true;
+        }
+
+        if (self->_nodemap & b) {
+            std::size_t ci = index(self->_nodemap, b);
+            // Avoid copying this node when the key is present below it and is not assigned.
+            if (!assign && contains(*self->_children[ci], h, shift + bits_per_level, key))
+                return false;
+            node& n = self.write();
+            return insert(n._children[ci], h, shift + bits_per_level, key, std::forward<M>(mapped),
+                          assign);
+        }
+
+        node& n = self.write();
+        n._values.emplace(n._values.begin() + static_cast<difference_type>(index(n._datamap, b)),
+                          key, std::forward<M>(mapped));
+        n._datamap |= b;
+        return true;
+    }
+
+    /// Returns true if the entry was found and erased.
+    auto erase(node_ptr& self, std::size_t h, unsigned shift, const K& key) -> bool {
+        if (is_collision(shift)) {
+            std::size_t i = find_collision(*self, key);
+            if (i == self->_values.size()) return false;
+            auto& values = self.write()._values;
+            values.erase(values.begin() + static_cast<difference_type>(i));
+            return true;
+        }
+
+        std::uint32_t b = bit(h, shift);
+        if (self->_datamap & b) {
+            std::size_t i = index(self->_datamap, b);
+            if (!_equal(self->_values[i].first, key)) return false;
+            node& n = self.write();
+            n._values.erase(n._values.begin() + static_cast<difference_type>(i));
+            n._datamap &= ~b;
+            return true;
+        }
+
+        if (!(self->_nodemap & b)) return false;
+        std::size_t ci = index(self->_nodemap, b);
+        {
+            // Avoid copying this node when the key is not present below it.
+            const node& child = *self->_children[ci];
+            if (!contains(child, h, shift + bits_per_level, key)) return false;
+        }
+        node& n = self.write();
+        erase(n._children[ci], h, shift + bits_per_level, key);
+
+        // Keep the trie canonical: a child left with a single entry and no children is inlined.
+        const node& child = *n._children[ci];
+        if (child._children.empty() && child._values.size() == 1) {
+            value_type entry = child._values.front();
+            n._children.erase(n._children.begin() + static_cast<difference_type>(ci));
+            n._nodemap &= ~b;
+            n._values.insert(n._values.begin() +
+                                 static_cast<difference_type>(index(n._datamap, b)),
+                             std::move(entry));
+            n._datamap |= b;
+        }
+        return true;
+    }
+
+    auto find(const node& n, std::size_t h, unsigned shift, const K& key) const
+        -> const value_type* {
+        const node* p = &n;
+        for (;; shift += bits_per_level) {
+            if (is_collision(shift)) {
+                std::size_t i = find_collision(*p, key);
+                return i == p->_values.size() ? nullptr : &p->_values[i];
+            }
+            std::uint32_t b = bit(h, shift);
+            if (p->_datamap & b) {
+                const value_type& entry = p->_values[index(p->_datamap, b)];
+                return _equal(entry.first, key) ? &entry : nullptr;
+            }
+            if (!(p->_nodemap & b)) return nullptr;
+            p = &p->_children[index(p->_nodemap, b)].read();
+        }
+    }
+
+    auto contains(const node& n, std::size_t h, unsigned shift, const K& key) const -> bool {
+        return find(n, h, shift, key) != nullptr;
+    }
+
+public:
+    /*!
+        A forward iterator over the entries, in an unspecified order. There is no mutable
+        iterator; use insert_or_assign() to modify an entry.
+    */
+    class const_iterator {
+        struct frame {
+            const node* _node;
+            std::size_t _value; // next entry of _node to visit
+            std::size_t _child; // next child of _node to visit
+        };
+
+        std::array<frame, max_depth> _stack{};
+        std::size_t _depth{0};
+
+        friend class cow_map;
+
+        explicit const_iterator(const node* root) noexcept {
+            _stack[_depth++] = frame{root, 0, 0};
+            settle();
+        }
+
+        // Advance until the top frame refers to an entry, or the stack is empty.
+        void settle() noexcept {
+            while (_depth != 0) {
+                frame& f = _stack[_depth - 1];
+                if (f._value < f._node->_values.size()) return;
+                if (f._child < f._node->_children.size()) {
+                    const node* child = &f._node->_children[f._child++].read();
+                    _stack[_depth++] = frame{child, 0, 0};
+                } else {
+                    --_depth;
+                }
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename cow_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        const_iterator() noexcept = default;
+
+        auto operator*() const noexcept -> reference {
+            const frame& f = _stack[_depth - 1];
+            return f._node->_values[f._value];
+        }
+
+        auto operator->() const noexcept -> pointer { return &**this; }
+
+        auto operator++() noexcept -> const_iterator& {
+            ++_stack[_depth - 1]._value;
+            settle();
+            return *this;
+        }
+
+        auto operator++(int) noexcept -> const_iterator {
+            auto result = *this;
+            ++*this;
+            return result;
+        }
+
+        friend auto operator==(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            if (x._depth != y._depth) return false;
+            if (x._depth == 0) return true;
+            const frame& a = x._stack[x._depth - 1];
+            const frame& b = y._stack[y._depth - 1];
+            return a._node == b._node && a._value == b._value;
+        }
+
+        friend auto operator!=(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            return !(x == y);
+        }
+    };
+
+    using iterator = const_iterator;
+
+    cow_map() = default;
+
+    explicit cow_map(const Hash& hash, const KeyEqual& equal = KeyEqual()) :
+        _hash(hash), _equal(equal) {}
+
+    /*!
+        @brief Constructs a map from the entries of `[first, last)`. Later duplicates are ignored.
+    */
+    template <class I, class = typename std::iterator_traits<I>::iterator_category>
+    cow_map(I first, I last) {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    cow_map(std::initializer_list<value_type> init) : cow_map(init.begin(), init.end()) {}
+
+    [[nodiscard]] auto size() const noexcept -> size_type { return _size; }
+    [[nodiscard]] auto empty() const noexcept -> bool { return _size == 0; }
+
+    auto hash_function() const -> hasher { return _hash; }
+    auto key_eq() const -> key_equal { return _equal; }
+
+    /*!
+        @brief Returns an iterator to the entry with `key`, or end() if there is none.
+    */
+    auto find(const K& key) const -> const_iterator {
+        const_iterator result;
+        const std::size_t h = hash(key);
+        const node* p = &_root.read();
+        for (unsigned shift = 0;; shift += bits_per_level) {
+            std::size_t i = p->_values.size();
+            if (is_collision(shift)) {
+                i = find_collision(*p, key);
+            } else {
+                std::uint32_t b = bit(h, shift);
+                if (p->_datamap & b) {
+                    i = index(p->_datamap, b);
+                    if (!_equal(p->_values[i].first, key)) return end();
+                } else if (p->_nodemap & b) {
+                    std::size_t ci = index(p->_nodemap, b);
+                    result._stack[result._depth++] = {p, p->_values.size(), ci + 1};
+                    p = &p->_children[ci].read();
+                    continue;
+                }
+            }
+            if (i == p->_values.size()) return end();
+            result._stack[result._depth++] = {p, i, 0};
+            return result;
+        }
+    }
+
+    [[nodiscard]] auto contains(const K& key) const -> bool {
+        return contains(*_root, hash(key), 0, key);
+    }
+
+    [[nodiscard]] auto count(const K& key) const -> size_type { return contains(key) ? 1 : 0; }
+
+    /*!
+        @brief Returns the value mapped to `key`, throwing `std::out_of_range` if there is none.
+    */
+    auto at(const K& key) const -> const V& {
+        const value_type* entry = find(*_root, hash(key), 0, key);
+        if (!entry) throw std::out_of_range("cow_map::at");
+        return entry->second;
+    }
+
+    /*!
+        @brief Inserts `x` if its key is not present. Returns true if it was inserted.
+    */
+    auto insert(const value_type& x) -> bool { return insert(x.first, x.second); }
+
+    /*!
+        @brief Inserts an entry mapping `key` to `mapped` if `key` is not present. Returns true if
+       it was inserted.
+
+        If an exception is thrown the map is unchanged, provided moving an entry does not throw.
+    */
+    template <class M>
+    auto insert(const K& key, M&& mapped) -> bool {
+        bool inserted = insert(_root, hash(key), 0, key, std::forward<M>(mapped), false);
+        _size += inserted;
+        return inserted;
+    }
+
+    /*!
+        @brief Maps `key` to `mapped`, inserting an entry if `key` is not present. Returns true if
+       an entry was inserted.
+    */
+    template <class M>
+    auto insert_or_assign(const K& key, M&& mapped) -> bool {
+        bool inserted = insert(_root, hash(key), 0, key, std::forward<M>(mapped), true);
+        _size += inserted;
+        return inserted;
+    }
+
+    /*!
+        @brief Removes the entry with `key`, if any. Returns the number of entries removed.
+    */
+    auto erase(const K& key) -> size_type {
+        bool erased = erase(_root, hash(key), 0, key);
+        _size -= erased;
+        return erased ? 1 : 0;
+    }
+
+    void clear() noexcept {
+        _root = node_ptr();
+        _size = 0;
+    }
+
+    auto begin() const noexcept -> const_iterator { return const_iterator(&_root.read()); }
+    auto end() const noexcept -> const_iterator { return const_iterator(); }
+    auto cbegin() const noexcept -> const_iterator { return begin(); }
+    auto cend() const noexcept -> const_iterator { return end(); }
+
+    /*!
+        @brief Returns true if both maps share the same root node, and so hold the same entries.
+    */
+    [[nodiscard]] auto identity(const cow_map& x) const noexcept -> bool {
+        return _root.identity(x._root);
+    }
+
+    friend void swap(cow_map& x, cow_map& y) noexcept {
+        swap(x._root, y._root);
+        std::swap(x._size, y._size);
+        std::swap(x._hash, y._hash);
+        std::swap(x._equal, y._equal);
+    }
+
+    /*!
+        @brief Equality compares the tries, skipping any nodes the maps share.
+    */
+    friend auto operator==(const cow_map& x, const cow_map& y) -> bool {
+        return x._size == y._size && x._root == y._root;
+    }
+
+    friend auto operator!=(const cow_map& x, const cow_map& y) -> bool { return !(x == y); }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -0,0 +1,326 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file cow_vector.hpp
+    @brief Chunked persistent vector built on copy_on_write
+
+    This file contains stlab::cow_vector, a sequence whose storage is split into fixed size
+    copy_on_write chunks so that modifying an element of a shared vector copies only the chunk
+    holding it.
+*/
+
+#ifndef STLAB_COW_VECTOR_HPP
+#define STLAB_COW_VECTOR_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    A vector with value semantics whose elements are stored in chunks of `ChunkSize` elements.
+
+    The vector is a two-level table: a copy_on_write table of copy_on_write chunks. Copying a
+    cow_vector is O(1). The first modification of a shared vector copies the table, O(size() /
+    ChunkSize) reference count increments, and the chunk holding the element, O(ChunkSize); later
+    modifications of the same chunk are in place. The default chunk size holds about 4 KiB.
+
+    All chunks except the last are full, so element access is a division and two indirections.
+*/
+template <class T, std::size_t ChunkSize = (sizeof(T) < 4096 ? 4096 / sizeof(T) : 1)>
+class cow_vector {
+    static_assert(ChunkSize > 0, "ChunkSize must be positive");
+
+    using chunk_type = copy_on_write<std::vector<T>>;
+    using table_type = std::vector<chunk_type>;
+
+    copy_on_write<table_type> _table;
+    std::size_t _size{0};
+
+    static auto chunk_index(std::size_t i) noexcept -> std::size_t { return i / ChunkSize; }
+    static auto chunk_offset(std::size_t i) noexcept -> std::size_t { return i % ChunkSize; }
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using const_reference = const T&;
+
+    /*!
+        The number of elements held by each chunk.
+    */
+    static constexpr size_type chunk_size = ChunkSize;
+
+    /*!
+        A random access iterator over the elements. There is no mutable iterator; use write() to
+        modify an element.
+    */
+    class const_iterator {
+        const cow_vector* _vector{nullptr};
+        size_type _index{0};
+
+        friend class cow_vector;
+
+        const_iterator(const cow_vector* v, size_type i) noexcept : _vector(v), _index(i) {}
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() noexcept = default;
+
+        auto operator*() const -> reference { return (*_vector)[_index]; }
+        auto operator->() const -> pointer { return &(*_vector)[_index]; }
+        auto operator[](difference_type n) const -> reference { return *(*this + n); }
+
+        auto operator++() noexcept -> const_iterator& {
+            ++_index;
+            return *this;
+        }
+        auto operator++(int) noexcept -> const_iterator {
+            auto result = *this;
+            ++_index;
+            return result;
+        }
+        auto operator--() noexcept -> const_iterator& {
+            --_index;
+            return *this;
+        }
+        auto operator--(int) noexcept -> const_iterator {
+            auto result = *this;
+            --_index;
+            return result;
+        }
+        auto operator+=(difference_type n) noexcept -> const_iterator& {
+            _index = static_cast<size_type>(static_cast<difference_type>(_index) + n);
+            return *this;
+        }
+        auto operator-=(difference_type n) noexcept -> const_iterator& { return *this += -n; }
+
+        friend auto operator+(const_iterator x, difference_type n) noexcept -> const_iterator {
+            return x += n;
+        }
+        friend auto operator+(difference_type n, const_iterator x) noexcept -> const_iterator {
+            return x += n;
+        }
+        friend auto operator-(const_iterator x, difference_type n) noexcept -> const_iterator {
+            return x -= n;
+        }
+        friend auto operator-(const const_iterator& x, const const_iterator& y) noexcept
+            -> difference_type {
+            return static_cast<difference_type>(x._index) - static_cast<difference_type>(y._index);
+        }
+
+        friend auto operator==(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            return x._index == y._index;
+        }
+        friend auto operator!=(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            return !(x == y);
+        }
+        friend auto operator<(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            return x._index < y._index;
+        }
+        friend auto operator>(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            return y < x;
+        }
+        friend auto operator<=(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            return !(y < x);
+        }
+        friend auto operator>=(const const_iterator& x, const const_iterator& y) noexcept -> bool {
+            return !(x < y);
+        }
+    };
+
+    using iterator = const_iterator;
+
+    cow_vector() = default;
+
+    /*!
+        @brief Constructs a vector of `n` copies of `x`.
+    */
+    cow_vector(size_type n, const T& x) {
+        for (; n != 0; --n)
+            push_back(x);
+    }
+
+    /*!
+        @brief Constructs a vector from the elements of `[first, last)`.
+    */
+    template <class I, class = typename std::iterator_traits<I>::iterator_category>
+    cow_vector(I first, I last) {
+        for (; first != last; ++first)
+            push_back(*first);
+    }
+
+    cow_vector(std::initializer_list<T> init) : cow_vector(init.begin(), init.end()) {}
+
+    [[nodiscard]] auto size() const noexcept -> size_type { return _size; }
+    [[nodiscard]] auto empty() const noexcept -> bool { return _size == 0; }
+
+    /*!
+        @brief Returns a const reference to the element at `i`.
+    */
+    auto operator[](size_type i) const noexcept -> const_reference {
+        assert(i < _size && "cow_vector index out of range");
+        return (*_table)[chunk_index(i)].read()[chunk_offset(i)];
+    }
+
+    /*!
+        @brief Returns a const reference to the element at `i`, throwing `std::out_of_range` if `i`
+       is not less than size().
+    */
+    auto at(size_type i) const -> const_reference {
+        if (i >= _size) throw std::out_of_range("cow_vector::at");
+        return (*this)[i];
+    }
+
+    auto front() const noexcept -> const_reference { return (*this)[0]; }
+    auto back() const noexcept -> const_reference { return (*this)[_size - 1]; }
+
+    /*!
+        @brief Returns a reference to the element at `i`, copying the table and the chunk holding
+       the element if they are shared.
+    */
+    auto write(size_type i) -> T& {
+        assert(i < _size && "cow_vector index out of range");
+        return _table.write()[chunk_index(i)].write()[chunk_offset(i)];
+    }
+
+    /*!
+        @brief Assigns `x` to the element at `i`.
+    */
+    template <class U>
+    void set(size_type i, U&& x) {
+        write(i) = std::forward<U>(x);
+    }
+
+    template <class... Args>
+    auto emplace_back(Args&&... args) -> T& {
+        if (chunk_offset(_size) != 0) {
+            // A shared last chunk is copied with room for a full chunk, so it is copied once.
+            auto& chunk = _table.write().back().write(
+                [](const std::vector<T>& x) {
+                    std::vector<T> result;
+                    result.reserve(ChunkSize);
+                    result.insert(result.end(), x.begin(), x.end());
+                    return result;
+                },
+                [](std::vector<T>&) {});
+            auto& result = chunk.emplace_back(std::forward<Args>(args)...);
+            ++_size;
+            return result;
+        }
+        // Construct the element before adding the chunk so a throwing constructor leaves the
+        // vector unchanged.
+        std::vector<T> chunk;
+        chunk.reserve(ChunkSize);
+        chunk.emplace_back(std::forward<Args>(args)...);
+        auto& table = _table.write();
+        table.emplace_back(std::move(chunk));
+        ++_size;
+        return table.back().write().back();
+    }
+
+    void push_back(const T& x) { emplace_back(x); }
+    void push_back(T&& x) { emplace_back(std::move(x)); }
+
+    void pop_back() {
+        assert(!empty() && "cow_vector::pop_back on empty vector");
+        auto& table = _table.write();
+        if (table.back()->size() == 1) {
+            table.pop_back();
+        } else {
+            table.back().write().pop_back();
+        }
+        --_size;
+    }
+
+    /*!
+        @brief Resizes the vector to `n` elements, appending copies of `x` if it grows.
+    */
+    void resize(size_type n, const T& x = T()) {
+        while (_size > n)
+            pop_back();
+        while (_size < n)
+            push_back(x);
+    }
+
+    void clear() noexcept {
+        _table = copy_on_write<table_type>();
+        _size = 0;
+    }
+
+    auto begin() const noexcept -> const_iterator { return {this, 0}; }
+    auto end() const noexcept -> const_iterator { return {this, _size}; }
+    auto cbegin() const noexcept -> const_iterator { return begin(); }
+    auto cend() const noexcept -> const_iterator { return end(); }
+
+    /*!
+        @brief Returns true if both vectors share the same table, and so hold the same elements.
+    */
+    [[nodiscard]] auto identity(const cow_vector& x) const noexcept -> bool {
+        return _table.identity(x._table);
+    }
+
+    friend void swap(cow_vector& x, cow_vector& y) noexcept {
+        swap(x._table, y._table);
+        std::swap(x._size, y._size);
+    }
+
+    /*!
+        @brief Equality compares elements, skipping any chunks the vectors share.
+    */
+    friend auto operator==(const cow_vector& x, const cow_vector& y) -> bool {
+        if (x._size != y._size) return false;
+        if (x.identity(y)) return true;
+        const auto& a = *x._table;
+        const auto& b = *y._table;
+        for (size_type i = 0, n = a.size(); i != n; ++i) {
+            if (a[i] != b[i]) return false;
+        }
+        return true;
+    }
+
+    friend auto operator!=(const cow_vector& x, const cow_vector& y) -> bool { return !(x == y); }
+
+    friend auto operator<(const cow_vector& x, const cow_vector& y) -> bool {
+        if (x.identity(y)) return false;
+        return std::lexicographical_compare(x.begin(), x.end(), y.begin(), y.end());
+    }
+
+    friend auto operator>(const cow_vector& x, const cow_vector& y) -> bool { return y < x; }
+    friend auto operator<=(const cow_vector& x, const cow_vector& y) -> bool { return !(y < x); }
+    friend auto operator>=(const cow_vector& x, const cow_vector& y) -> bool { return !(x < y); }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -0,0 +1,277 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file history.hpp
+    @brief Undo/redo history of copy_on_write snapshots with a memory budget
+
+    This file contains stlab::history, a linear undo/redo stack of copy_on_write snapshots that
+    accounts for the memory shared between snapshots and evicts the oldest states when a byte
+    budget is exceeded.
+*/
+
+#ifndef STLAB_HISTORY_HPP
+#define STLAB_HISTORY_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+#include <stlab/size_of.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    A linear undo/redo history of `copy_on_write<T, Policy>` snapshots.
+
+    commit(), undo(), redo() and current() are O(1) (commit() is amortized, since it releases the
+    states it discards). Committing a snapshot that shares its identity with the current state is
+    a no-op, so repeated commits of an unmodified document do not grow the history. Committing
+    after an undo discards the redo states.
+
+    The history keeps track of the memory its snapshots hold. Each distinct underlying value is
+    measured once with `SizeOf` when it enters the history, so resident_bytes() reports the memory
+    actually held rather than the sum of the snapshot sizes, which is reported by logical_bytes().
+    When resident_bytes() exceeds the budget the oldest states are evicted, then the most distant
+    redo states. The current state is never evicted.
+
+    @code
+    stlab::history<document> h(doc, 64 << 20);
+    doc.write().insert(...);
+    h.commit(doc);
+    h.undo();
+    doc = h.current();
+    @endcode
+*/
+template <class T, class Policy = threading::multi, class SizeOf = default_size_of<T>>
+class history {
+public:
+    using value_type = copy_on_write<T, Policy>;
+    using size_type = std::size_t;
+
+    /*!
+        @brief A budget that never evicts.
+    */
+    static constexpr size_type unlimited = std::numeric_limits<size_type>::max();
+
+private:
+    // Identities of inline values are their addresses, so they change when a value is moved.
+    static constexpr bool is_inline = Policy::template store_inline<T>;
+
+    struct residency {
+        size_type _count;
+        size_type _bytes;
+    };
+
+    std::deque<value_type> _states;
+    size_type _current{0};
+    size_type _budget{unlimited};
+    size_type _resident{0};
+    size_type _logical{0};
+    std::unordered_map<const void*, residency> _residents;
+    SizeOf _size_of;
+
+    void acquire(const value_type& x) {
+        auto p = _residents.find(x.identity());
+        if (p == _residents.end()) {
+            size_type bytes = _size_of(x.read());
+            p = _residents.emplace(x.identity(), residency{0, bytes}).first;
+            _resident += bytes;
+        }
+        ++p->second._count;
+        _logical += p->second._bytes;
+    }
+
+    void release(const value_type& x) noexcept {
+        auto p = _residents.find(x.identity());
+        assert(p != _residents.end() && "history residency out of sync");
+        _logical -= p->second._bytes;
+        if (--p->second._count == 0) {
+            _resident -= p->second._bytes;
+            _residents.erase(p);
+        }
+    }
+
+    /// Replaces the state in `slot` with `x`. Only the size of `x` is computed before any change.
+    void replace(value_type& slot, value_type&& x) {
+        if constexpr (is_inline) {
+            // The entry for the slot's address is reused for the new value.
+            size_type bytes = _size_of(x.read());
+            residency& r = _residents.find(slot.identity())->second;
+            _resident = _resident - r._bytes + bytes;
+            _logical = _logical - r._bytes + bytes;
+            r._bytes = bytes;
+        } else {
+            acquire(x);
+            release(slot);
+        }
+        slot = std::move(x);
+    }
+
+    void pop_front() noexcept {
+        release(_states.front());
+        _states.pop_front();
+        --_current;
+    }
+
+    void pop_back() noexcept {
+        release(_states.back());
+        _states.pop_back();
+    }
+
+    void evict() noexcept {
+        while (_resident > _budget && _states.size() > 1) {
+            if (_current != 0) {
+                pop_front();
+            } else {
+                pop_back();
+            }
+        }
+    }
+
+public:
+    /*!
+        @brief Constructs a history whose only state is `initial`, evicting states when more than
+       `budget` bytes are resident.
+    */
+    explicit history(value_type initial = value_type(), size_type budget = unlimited,
+                     SizeOf size_of = SizeOf()) :
+        _budget(budget), _size_of(std::move(size_of)) {
+        _states.push_back(std::move(initial));
+        acquire(_states.back());
+    }
+
+    history(const history& x) :
+        _states(x._states), _current(x._current), _budget(x._budget), _size_of(x._size_of) {
+        // Identity keys of inline values are addresses within _states, so rebuild the table.
+        for (const auto& e : _states)
+            acquire(e);
+    }
+
+    history(history&&) = default;
+
+    auto operator=(const history& x) -> history& {
+        history tmp(x);
+        *this = std::move(tmp);
+        return *this;
+    }
+
+    auto operator=(history&&) -> history& = default;
+
+    /*!
+        @brief Returns the current state.
+    */
+    [[nodiscard]] auto current() const noexcept -> const value_type& { return _states[_current]; }
+
+    /*!
+        @brief Makes `x` the current state, discarding any redo states. Returns false, leaving the
+       history unchanged, if `x` shares its identity with the current state. If an exception is
+       thrown the history is unchanged.
+    */
+    auto commit(value_type x) -> bool {
+        if (x.identity(current())) return false;
+        if (_current + 1 == _states.size()) {
+            _states.push_back(std::move(x));
+            try {
+                acquire(_states.back());
+            } catch (...) {
+                _states.pop_back();
+                throw;
+            }
+        } else {
+            // The new state takes the first redo slot, so the other redo states are only
+            // discarded once nothing more can throw.
+            replace(_states[_current + 1], std::move(x));
+            while (_states.size() > _current + 2)
+                pop_back();
+        }
+        ++_current;
+        evict();
+        return true;
+    }
+
+    /*!
+        @brief Steps back to the previous state. Returns false if there is none.
+    */
+    auto undo() noexcept -> bool {
+        if (_current == 0) return false;
+        --_current;
+        return true;
+    }
+
+    /*!
+        @brief Steps forward to the next state. Returns false if there is none.
+    */
+    auto redo() noexcept -> bool {
+        if (_current + 1 == _states.size()) return false;
+        ++_current;
+        return true;
+    }
+
+    [[nodiscard]] auto can_undo() const noexcept -> bool { return _current != 0; }
+    [[nodiscard]] auto can_redo() const noexcept -> bool { return _current + 1 != _states.size(); }
+
+    [[nodiscard]] auto undo_count() const noexcept -> size_type { return _current; }
+    [[nodiscard]] auto redo_count() const noexcept -> size_type {
+        return _states.size() - _current - 1;
+    }
+
+    /*!
+        @brief Returns the number of states, including the current one.
+    */
+    [[nodiscard]] auto size() const noexcept -> size_type { return _states.size(); }
+
+    /*!
+        @brief Discards every state except the current one.
+    */
+    void clear() noexcept {
+        while (_states.size() > _current + 1)
+            pop_back();
+        while (_current != 0)
+            pop_front();
+    }
+
+    /*!
+        @brief Returns the bytes held by the distinct values in the history.
+    */
+    [[nodiscard]] auto resident_bytes() const noexcept -> size_type { return _resident; }
+
+    /*!
+        @brief Returns the sum of the sizes of all states, counting shared values once per state.
+    */
+    [[nodiscard]] auto logical_bytes() const noexcept -> size_type { return _logical; }
+
+    [[nodiscard]] auto budget() const noexcept -> size_type { return _budget; }
+
+    /*!
+        @brief Sets the budget, evicting states if more than `budget` bytes are resident.
+    */
+    void set_budget(size_type budget) noexcept {
+        _budget = budget;
+        evict();
+    }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -0,0 +1,156 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file intern_pool.hpp
+    @brief Interning of equal copy_on_write values
+
+    This file contains stlab::intern_pool, which maps copy_on_write values with equal content to
+    a single canonical shared value.
+*/
+
+#ifndef STLAB_INTERN_POOL_HPP
+#define STLAB_INTERN_POOL_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+#include <unordered_set>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    A thread-safe pool of canonical `copy_on_write<T, Policy>` values.
+
+    intern() returns a handle sharing the pool's value equal to its argument, adding the argument
+    if there is none, so values loaded separately end up sharing one model. Values are found with
+    `Hash` and compared with `Equal`, after an identity check; with the hashing::cached policy and
+    the default `Hash` each value is hashed only once.
+
+    The pool holds its values strongly, so releasing the last handle outside the pool does not
+    destroy a value: it stays in the pool, unused, until a collection. collect() removes the
+    unused values, and intern() runs it once the pool reaches twice its size after the last
+    collection, and at least 64 values. Until then an unused value and its model stay alive,
+    indefinitely if the pool stops growing; call collect() to reclaim them sooner.
+*/
+template <class T,
+          class Policy = threading::multi,
+          class Hash = std::hash<T>,
+          class Equal = std::equal_to<T>>
+class intern_pool {
+public:
+    using value_type = copy_on_write<T, Policy>;
+    using size_type = std::size_t;
+
+private:
+    static constexpr size_type min_collect_size = 64;
+
+    struct value_hash {
+        Hash _hash;
+
+        auto operator()(const value_type& x) const -> std::size_t {
+            if constexpr (std::is_same_v<Hash, std::hash<T>>) {
+                return std::hash<value_type>{}(x);
+            } else {
+                return _hash(x.read());
+            }
+        }
+    };
+
+    struct value_equal {
+        Equal _equal;
+
+        auto operator()(const value_type& x, const value_type& y) const -> bool {
+            return x.identity(y) || _equal(x.read(), y.read());
+        }
+    };
+
+    mutable std::mutex _mutex;
+    std::unordered_set<value_type, value_hash, value_equal> _values;
+    size_type _collect_size{min_collect_size};
+
+    auto collect_locked() -> size_type {
+        size_type result = 0;
+        for (auto p = _values.begin(); p != _values.end();) {
+            if (p->unique()) {
+                p = _values.erase(p);
+                ++result;
+            } else {
+                ++p;
+            }
+        }
+        _collect_size = std::max(min_collect_size, 2 * _values.size());
+        return result;
+    }
+
+public:
+    intern_pool() = default;
+
+    explicit intern_pool(const Hash& hash, const Equal& equal = Equal()) :
+        _values(0, value_hash{hash}, value_equal{equal}) {}
+
+    intern_pool(const intern_pool&) = delete;
+    auto operator=(const intern_pool&) -> intern_pool& = delete;
+
+    /*!
+        @brief Returns the pool's value equal to `x`, adding `x` to the pool if there is none.
+    */
+    auto intern(const value_type& x) -> value_type {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto [p, inserted] = _values.insert(x);
+        if (inserted && _values.size() >= _collect_size) {
+            value_type result = *p; // keep the new value from being collected
+            collect_locked();
+            return result;
+        }
+        return *p;
+    }
+
+    /*!
+        @brief Removes the values for which the pool holds the only reference. Returns the number
+       of values removed.
+    */
+    auto collect() -> size_type {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return collect_locked();
+    }
+
+    /*!
+        @brief Returns the number of values in the pool, including unused values not yet
+       collected.
+    */
+    [[nodiscard]] auto size() const -> size_type {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _values.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _values.clear();
+        _collect_size = min_collect_size;
+    }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -0,0 +1,161 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file memory_report.hpp
+    @brief Memory accounting for collections of copy_on_write handles
+
+    This file contains stlab::memory_meter and stlab::measure_memory, which measure how much memory
+    a collection of copy_on_write handles really holds, counting each shared value once.
+*/
+
+#ifndef STLAB_MEMORY_REPORT_HPP
+#define STLAB_MEMORY_REPORT_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+#include <stlab/size_of.hpp>
+
+#include <cstddef>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    The memory held by a collection of handles.
+*/
+struct memory_report {
+    std::size_t handles = 0;        ///< the number of handles measured
+    std::size_t unique_models = 0;  ///< the number of distinct values among them
+    std::size_t logical_bytes = 0;  ///< the total size of the values, as if none were shared
+    std::size_t resident_bytes = 0; ///< the total size of the distinct values
+
+    /// `sharing[k]` is the number of distinct values referred to by between `2^k` and
+    /// `2^(k + 1) - 1` of the handles measured, so `sharing[0]` counts the unshared values.
+    std::vector<std::size_t> sharing;
+
+    /*!
+        @brief Returns logical_bytes() / resident_bytes(), the factor by which sharing reduces the
+       memory held, or 1 if nothing was measured.
+    */
+    [[nodiscard]] auto sharing_ratio() const noexcept -> double {
+        return resident_bytes == 0 ? 1.0
+                                   : static_cast<double>(logical_bytes) /
+                                         static_cast<double>(resident_bytes);
+    }
+};
+
+/*!
+    Accumulates a memory_report over handles of type `Handle`, such as `copy_on_write<T, Policy>`
+    or copy_on_write_intrusive<T>. Handles are identified by `identity()`, and the value of each
+    distinct handle is measured once with `SizeOf`, which may be replaced to include memory owned
+    by the elements of a value.
+
+    Handles may be added from several collections; a value they share is still counted once. The
+    values must not be destroyed while the meter is in use, since their identities could be
+    reused.
+*/
+template <class Handle, class SizeOf = default_size_of<typename Handle::element_type>>
+class memory_meter {
+    struct entry {
+        std::size_t _handles;
+        std::size_t _bytes;
+    };
+
+    std::unordered_map<const void*, entry> _models;
+    std::size_t _handles{0};
+    std::size_t _logical{0};
+    SizeOf _size_of;
+
+public:
+    explicit memory_meter(SizeOf size_of = SizeOf()) : _size_of(std::move(size_of)) {}
+
+    /*!
+        @brief Adds a handle.
+    */
+    void add(const Handle& x) {
+        auto [p, inserted] = _models.try_emplace(x.identity(), entry{0, 0});
+        if (inserted) p->second._bytes = _size_of(*x);
+        ++p->second._handles;
+        ++_handles;
+        _logical += p->second._bytes;
+    }
+
+    /*!
+        @brief Adds the handles in `[first, last)`.
+    */
+    template <class InputIt>
+    void add(InputIt first, InputIt last) {
+        for (; first != last; ++first)
+            add(*first);
+    }
+
+    /*!
+        @brief Returns the report for the handles added so far. O(number of distinct values).
+    */
+    [[nodiscard]] auto report() const -> memory_report {
+        memory_report result;
+        result.handles = _handles;
+        result.unique_models = _models.size();
+        result.logical_bytes = _logical;
+        for (const auto& [identity, e] : _models) {
+            (void)identity;
+            result.resident_bytes += e._bytes;
+            std::size_t bucket = 0;
+            for (std::size_t n = e._handles; n > 1; n >>= 1)
+                ++bucket;
+            if (result.sharing.size() <= bucket) result.sharing.resize(bucket + 1);
+            ++result.sharing[bucket];
+        }
+        return result;
+    }
+
+    /*!
+        @brief Removes all handles.
+    */
+    void clear() noexcept {
+        _models.clear();
+        _handles = 0;
+        _logical = 0;
+    }
+};
+
+/*!
+    @brief Returns the memory_report for the handles in `[first, last)`.
+
+    @code
+    auto report = stlab::measure_memory(snapshots.begin(), snapshots.end());
+    log("{} snapshots hold {} bytes", report.handles, report.resident_bytes);
+    @endcode
+*/
+template <class InputIt,
+          class SizeOf = default_size_of<
+              typename std::iterator_traits<InputIt>::value_type::element_type>>
+auto measure_memory(InputIt first, InputIt last, SizeOf size_of = SizeOf()) -> memory_report {
+    memory_meter<typename std::iterator_traits<InputIt>::value_type, SizeOf> meter(
+        std::move(size_of));
+    meter.add(first, last);
+    return meter.report();
+}
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -0,0 +1,235 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file numa_replicated_cow.hpp
+    @brief Per NUMA node replicas of a read-mostly copy_on_write value
+
+    This file contains stlab::numa_replicated_cow, which serves reads of a copy_on_write value from
+    a copy on the reading thread's NUMA node, and stlab::numa_topology, which describes the nodes.
+*/
+
+#ifndef STLAB_NUMA_REPLICATED_COW_HPP
+#define STLAB_NUMA_REPLICATED_COW_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    The NUMA topology of the system. On Linux the nodes are read from sysfs and the current node
+    from `getcpu()`; elsewhere the system is treated as a single node.
+*/
+struct numa_topology {
+    /*!
+        @brief Returns the number of nodes, at least 1.
+    */
+    static auto node_count() -> std::size_t {
+        static const std::size_t count_s = [] {
+            std::size_t count = 1;
+#if defined(__linux__)
+            // The file holds a range list such as "0" or "0-3"; the last number is the highest.
+            std::ifstream possible("/sys/devices/system/node/possible");
+            std::string list;
+            if (possible >> list) {
+                auto p = list.find_last_of(",-");
+                try {
+                    count = std::stoul(p == std::string::npos ? list : list.substr(p + 1)) + 1;
+                } catch (...) {
+                }
+            }
+#endif
+            return count;
+        }();
+        return count_s;
+    }
+
+    /*!
+        @brief Returns the node of the CPU the calling thread is running on. The thread may
+       migrate at any time, so the result is a hint.
+    */
+    static auto current_node() noexcept -> std::size_t {
+#if defined(__linux__) && defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (::getcpu(&cpu, &node) == 0) return node;
+#endif
+        return 0;
+    }
+};
+
+/**************************************************************************************************/
+
+/*!
+    A `copy_on_write<T, Policy>` whose value is replicated, on demand, to each NUMA node it is
+    read from.
+
+    When a thread first reads the value on a node, it copies the value into a replica with its own
+    model and reference count. The memory is first touched by that thread, so it is normally placed
+    on that node. Later reads and load() on the node use the replica, so threads on different
+    sockets neither fetch the value from a remote node nor contend on one reference count.
+
+    The logical value is unchanged by replication: write(), assignment and store() produce a new
+    single version and discard the replicas, which are rebuilt as the new version is read. This
+    suits values that are read far more often than they are written. On a single node system no
+    replicas are made.
+
+    Concurrent calls of the const members are safe. Non-const members must not be called
+    concurrently with any other member, as with copy_on_write. `Topology` supplies the static
+    functions `node_count()` and `current_node()`.
+*/
+template <class T, class Policy = threading::multi, class Topology = numa_topology>
+class numa_replicated_cow {
+public:
+    using value_type = copy_on_write<T, Policy>;
+    using element_type = T;
+
+private:
+    // Each slot is on its own cache line, so installing a replica does not disturb other nodes.
+    struct alignas(64) slot {
+        std::atomic<value_type*> _replica{nullptr};
+    };
+
+    value_type _value;
+    std::size_t _nodes;
+    std::unique_ptr<slot[]> _slots;
+
+    auto replica() const -> const value_type& {
+        if (_nodes == 1) return _value;
+
+        std::size_t node = Topology::current_node();
+        if (node >= _nodes) node %= _nodes;
+        slot& s = _slots[node];
+
+        value_type* r = s._replica.load(std::memory_order_acquire);
+        if (r) return *r;
+
+        auto fresh = std::make_unique<value_type>(_value.read());
+        if (s._replica.compare_exchange_strong(r, fresh.get(), std::memory_order_acq_rel,
+                                               std::memory_order_acquire)) {
+            r = fresh.release();
+        }
+        return *r;
+    }
+
+    void discard_replicas() noexcept {
+        if (!_slots) return;
+        for (std::size_t i = 0; i != _nodes; ++i) {
+            delete _slots[i]._replica.exchange(nullptr, std::memory_order_acq_rel);
+        }
+    }
+
+public:
+    /*!
+        @brief Holds a default constructed value.
+    */
+    numa_replicated_cow() : numa_replicated_cow(value_type()) {}
+
+    /*!
+        @brief Holds `x`, replicated to `Topology::node_count()` nodes.
+    */
+    explicit numa_replicated_cow(value_type x) :
+        _value(std::move(x)), _nodes(Topology::node_count()),
+        _slots(_nodes > 1 ? std::make_unique<slot[]>(_nodes) : nullptr) {
+        assert(_nodes != 0 && "Topology::node_count() must be at least 1");
+    }
+
+    numa_replicated_cow(const numa_replicated_cow& x) : numa_replicated_cow(x._value) {}
+
+    auto operator=(const numa_replicated_cow& x) -> numa_replicated_cow& {
+        store(x._value);
+        return *this;
+    }
+
+    ~numa_replicated_cow() { discard_replicas(); }
+
+    /*!
+        @brief Returns the value, from the replica on the calling thread's node. The reference is
+       valid until this object is modified or destroyed.
+    */
+    [[nodiscard]] auto read() const -> const element_type& { return replica().read(); }
+
+    auto operator*() const -> const element_type& { return read(); }
+    auto operator->() const -> const element_type* { return &read(); }
+
+    /*!
+        @brief Returns a handle to the replica on the calling thread's node, which remains valid
+       however this object is modified.
+    */
+    [[nodiscard]] auto load() const -> value_type { return replica(); }
+
+    /*!
+        @brief Returns a handle to the logical value, which is not a replica.
+    */
+    [[nodiscard]] auto get() const noexcept -> const value_type& { return _value; }
+
+    /*!
+        @brief Obtains a non-const reference to the value, discarding the replicas.
+    */
+    auto write() -> element_type& {
+        discard_replicas();
+        return _value.write();
+    }
+
+    /*!
+        @brief Replaces the value, discarding the replicas.
+    */
+    void store(value_type x) noexcept {
+        discard_replicas();
+        _value = std::move(x);
+    }
+
+    auto operator=(value_type x) noexcept -> numa_replicated_cow& {
+        store(std::move(x));
+        return *this;
+    }
+
+    /*!
+        @brief Returns the number of nodes the value may be replicated to.
+    */
+    [[nodiscard]] auto node_count() const noexcept -> std::size_t { return _nodes; }
+
+    /*!
+        @brief Returns the number of replicas currently made.
+    */
+    [[nodiscard]] auto replica_count() const noexcept -> std::size_t {
+        std::size_t n = 0;
+        for (std::size_t i = 0; _slots && i != _nodes; ++i) {
+            if (_slots[i]._replica.load(std::memory_order_relaxed)) ++n;
+        }
+        return n;
+    }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
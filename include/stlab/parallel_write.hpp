@@ -0,0 +1,140 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file parallel_write.hpp
+    @brief Detaching writes which copy large containers with a parallel algorithm
+
+    This file contains an overload of stlab::write taking a standard execution policy. It is kept
+    out of copy_on_write.hpp since `<execution>` may require linking a parallel backend, such as
+    TBB with libstdc++.
+*/
+
+#ifndef STLAB_PARALLEL_WRITE_HPP
+#define STLAB_PARALLEL_WRITE_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+#include <stlab/size_of.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <execution>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+namespace detail {
+
+/*
+    True for containers such as `std::vector` and `std::deque` which can be sized and then filled
+    through random access iterators. Containers whose references are proxies, such as
+    `std::vector<bool>`, are excluded since assigning through them concurrently is a data race.
+*/
+template <class T, class = void>
+constexpr bool is_parallel_copyable_v = false;
+
+template <class T>
+constexpr bool is_parallel_copyable_v<
+    T,
+    std::void_t<decltype(std::declval<T&>().resize(std::declval<const T&>().size())),
+                decltype(std::declval<T&>().begin()),
+                std::enable_if_t<std::is_base_of_v<
+                    std::random_access_iterator_tag,
+                    typename std::iterator_traits<typename T::iterator>::iterator_category>>>> =
+    std::is_same_v<typename T::reference, typename T::value_type&> &&
+    std::is_default_constructible_v<typename T::value_type> &&
+    std::is_copy_assignable_v<typename T::value_type>;
+
+/*
+    True for containers which can be constructed from the allocator they return.
+*/
+template <class T, class = void>
+constexpr bool has_allocator_v = false;
+
+template <class T>
+constexpr bool has_allocator_v<T, std::void_t<decltype(std::declval<const T&>().get_allocator())>> =
+    std::is_constructible_v<T, decltype(std::declval<const T&>().get_allocator())>;
+
+/// Returns an empty container using the allocator of `x`, if it has one.
+template <class T>
+auto empty_like(const T& x) -> T {
+    if constexpr (has_allocator_v<T>) {
+        return T(x.get_allocator());
+    } else {
+        (void)x;
+        return T();
+    }
+}
+
+} // namespace detail
+
+/**************************************************************************************************/
+
+/*!
+    The size, as measured by default_size_of, from which write(exec, x) copies in parallel.
+*/
+inline constexpr std::size_t parallel_write_threshold = std::size_t{1} << 20;
+
+/*!
+    @brief Obtains a non-const reference to the value of `x` like `x.write()`, except that if the
+   value must be copied, is a random access container, and occupies at least `threshold` bytes,
+   its elements are copied with `std::copy(exec, ...)`.
+
+    The value must be copied exactly when `x.write()` would copy it, for example because it is
+    shared or is an external value. The copy is made by value initializing a container of the same
+    size, with the allocator of the value if it has one, and assigning the elements to it, so it
+    applies when both are cheap compared to the serial copy. Smaller values, other types, and
+    values which are written in place are handled by `x.write()`. As with any parallel algorithm,
+    an exception thrown while copying an element calls `std::terminate` under the parallel
+    policies.
+
+    @code
+    auto& pixels = stlab::write(std::execution::par, image); // detaches on several threads
+    @endcode
+*/
+template <class ExecutionPolicy,
+          class T,
+          class Policy,
+          std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>>* = nullptr>
+auto write(ExecutionPolicy&& exec,
+           copy_on_write<T, Policy>& x,
+           std::size_t threshold = parallel_write_threshold) -> T& {
+    if constexpr (detail::is_parallel_copyable_v<T>) {
+        if (!detail::writable(x) && default_size_of<T>{}(*x) >= threshold) {
+            return x.write(
+                [&](const T& value) {
+                    T result = detail::empty_like(value);
+                    result.resize(value.size());
+                    std::copy(std::forward<ExecutionPolicy>(exec), value.begin(), value.end(),
+                              result.begin());
+                    return result;
+                },
+                [](T&) {});
+        }
+    }
+    (void)exec;
+    (void)threshold;
+    return x.write();
+}
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
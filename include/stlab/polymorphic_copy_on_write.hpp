@@ -0,0 +1,232 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file polymorphic_copy_on_write.hpp
+    @brief Copy-on-write for values of any type derived from a common base
+
+    This file contains stlab::polymorphic_copy_on_write, a copy-on-write handle to a value of any
+    type derived from `Base`, stored directly in the shared model.
+*/
+
+#ifndef STLAB_POLYMORPHIC_COPY_ON_WRITE_HPP
+#define STLAB_POLYMORPHIC_COPY_ON_WRITE_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+
+#include <cassert>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    A copy-on-write handle to a value whose type is derived from `Base`, for collections of
+    heterogeneous values such as the nodes of a scene graph.
+
+    The concrete value is stored in the model together with the reference count, so each value is
+    a single allocation, reached through the handle with a single indirection, and a detaching
+    write copies it with the concrete type's copy constructor. `Base` need not have a virtual
+    destructor or a clone function: the model's own virtual functions destroy and copy the concrete
+    value. `Policy` is a copy_on_write policy supplying the reference count and reclamation; its
+    reclaim function is given the concrete value, so policies such as reclaim::deferred measure
+    the whole value.
+
+    @code
+    std::vector<stlab::polymorphic_copy_on_write<shape>> scene{circle{1.0}, square{2.0}};
+    auto copy = scene;             // shares every node
+    copy[0].write().scale(2.0);    // copies only the circle
+    @endcode
+*/
+template <class Base, class Policy = threading::multi>
+class polymorphic_copy_on_write {
+    using counter_type = typename Policy::counter;
+
+    struct model {
+        counter_type _count{1};
+        Base* _object; // the value, as a Base
+
+        explicit model(Base* object) noexcept : _object(object) {}
+        model(const model&) = delete;
+        auto operator=(const model&) -> model& = delete;
+        virtual ~model() = default;
+
+        [[nodiscard]] virtual auto clone() const -> model* = 0;
+        [[nodiscard]] virtual auto type() const noexcept -> const std::type_info& = 0;
+
+        /// Hands the model, whose last reference was released, to the policy to be destroyed.
+        virtual void reclaim() noexcept = 0;
+    };
+
+    template <class T>
+    struct value_model final : model {
+        T _value;
+
+        template <class... Args>
+        explicit value_model(Args&&... args) :
+            model(nullptr), _value(std::forward<Args>(args)...) {
+            this->_object = &_value;
+        }
+
+        [[nodiscard]] auto clone() const -> model* override { return new value_model(_value); }
+        [[nodiscard]] auto type() const noexcept -> const std::type_info& override {
+            return typeid(T);
+        }
+
+        // Reclaimed with the concrete type, so the policy measures the whole value.
+        void reclaim() noexcept override {
+            Policy::reclaim(std::as_const(_value), static_cast<model*>(this), &destroy_model);
+        }
+    };
+
+    model* _self;
+
+    template <class U>
+    using enable_derived =
+        std::enable_if_t<!std::is_same_v<std::decay_t<U>, polymorphic_copy_on_write> &&
+                         std::is_base_of_v<Base, std::decay_t<U>>>*;
+
+    template <class U>
+    using enable_derived_assign =
+        std::enable_if_t<!std::is_same_v<std::decay_t<U>, polymorphic_copy_on_write> &&
+                             std::is_base_of_v<Base, std::decay_t<U>>,
+                         polymorphic_copy_on_write&>;
+
+    template <class T, class... Args>
+    static auto make(Args&&... args) -> model* {
+        static_assert(std::is_base_of_v<Base, T>, "T must be derived from Base");
+        static_assert(std::is_copy_constructible_v<T>, "T must be copy constructible");
+        return new value_model<T>(std::forward<Args>(args)...);
+    }
+
+    static void destroy_model(void* self) noexcept { delete static_cast<model*>(self); }
+
+    void release() noexcept {
+        if (_self && _self->_count.decrement()) _self->reclaim();
+    }
+
+public:
+    /*!
+        @brief The type through which the value is accessed
+    */
+    using element_type = Base;
+
+    /*!
+        @brief Constructs a handle to a copy of `x`, with the concrete type of the argument.
+    */
+    template <class U>
+    polymorphic_copy_on_write(U&& x, enable_derived<U> = nullptr) :
+        _self(make<std::decay_t<U>>(std::forward<U>(x))) {}
+
+    /*!
+        @brief Constructs a handle to a `T` by forwarding `args` to its constructor.
+    */
+    template <class T, class... Args>
+    explicit polymorphic_copy_on_write(std::in_place_type_t<T>, Args&&... args) :
+        _self(make<T>(std::forward<Args>(args)...)) {}
+
+    polymorphic_copy_on_write(const polymorphic_copy_on_write& x) noexcept : _self(x._self) {
+        assert(_self && "FATAL (sparent) : using a moved polymorphic_copy_on_write object");
+        _self->_count.increment();
+    }
+
+    polymorphic_copy_on_write(polymorphic_copy_on_write&& x) noexcept :
+        _self(std::exchange(x._self, nullptr)) {}
+
+    ~polymorphic_copy_on_write() { release(); }
+
+    auto operator=(const polymorphic_copy_on_write& x) noexcept -> polymorphic_copy_on_write& {
+        assert(this != &x && "self-assignment is not allowed");
+        return *this = polymorphic_copy_on_write(x);
+    }
+
+    auto operator=(polymorphic_copy_on_write&& x) noexcept -> polymorphic_copy_on_write& {
+        auto tmp{std::move(x)};
+        swap(*this, tmp);
+        return *this;
+    }
+
+    /*!
+        @brief Replaces the value with a copy of `x`, with the concrete type of the argument.
+    */
+    template <class U>
+    auto operator=(U&& x) -> enable_derived_assign<U> {
+        return *this = polymorphic_copy_on_write(std::forward<U>(x));
+    }
+
+    /*!
+        @brief Obtains a non-const reference to the value, copying it with its concrete type's copy
+       constructor if it is shared.
+    */
+    auto write() -> element_type& {
+        if (!unique()) *this = polymorphic_copy_on_write(adopt_t{}, _self->clone());
+        return *_self->_object;
+    }
+
+    [[nodiscard]] auto read() const noexcept -> const element_type& {
+        assert(_self && "FATAL (sparent) : using a moved polymorphic_copy_on_write object");
+        return *_self->_object;
+    }
+
+    operator const element_type&() const noexcept { return read(); }
+    auto operator*() const noexcept -> const element_type& { return read(); }
+    auto operator->() const noexcept -> const element_type* { return &read(); }
+
+    /*!
+        @brief Returns the concrete type of the value.
+    */
+    [[nodiscard]] auto type() const noexcept -> const std::type_info& {
+        assert(_self && "FATAL (sparent) : using a moved polymorphic_copy_on_write object");
+        return _self->type();
+    }
+
+    /*!
+        @brief Returns a pointer to the value if its concrete type is `T`, otherwise `nullptr`.
+    */
+    template <class T>
+    [[nodiscard]] auto target() const noexcept -> const T* {
+        if (type() != typeid(T)) return nullptr;
+        return &static_cast<const value_model<T>*>(_self)->_value;
+    }
+
+    [[nodiscard]] auto unique() const noexcept -> bool {
+        assert(_self && "FATAL (sparent) : using a moved polymorphic_copy_on_write object");
+        return _self->_count.load() == 1;
+    }
+
+    [[nodiscard]] auto identity(const polymorphic_copy_on_write& x) const noexcept -> bool {
+        return _self == x._self;
+    }
+
+    [[nodiscard]] auto identity() const noexcept -> const void* { return _self; }
+
+    friend inline void swap(polymorphic_copy_on_write& x, polymorphic_copy_on_write& y) noexcept {
+        std::swap(x._self, y._self);
+    }
+
+private:
+    struct adopt_t {};
+
+    polymorphic_copy_on_write(adopt_t, model* self) noexcept : _self(self) {}
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
@@ -0,0 +1,318 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file pool_allocator.hpp
+    @brief Thread-caching pool allocator for copy_on_write models
+
+    This file contains stlab::pool_allocator, an allocator for fixed size blocks built from per-size
+    pools with per-thread magazines and a lock-free global depot. It is intended for use with
+    stlab::allocate_copy_on_write so that the models created and released by detaching writes are
+    recycled rather than returned to the global heap.
+*/
+
+#ifndef STLAB_POOL_ALLOCATOR_HPP
+#define STLAB_POOL_ALLOCATOR_HPP
+
+/**************************************************************************************************/
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+namespace detail {
+
+/**************************************************************************************************/
+
+/*
+    A pool of blocks of `Size` bytes.
+
+    Each thread caches blocks in two magazines (a loaded and a previous one) so most allocations
+    and deallocations touch only thread-local state. Full and empty magazines are exchanged with a
+    global depot made of two lock-free lists. A list is popped by taking the whole list and pushing
+    the remainder back, so no node is ever read after another thread may have reused it, which
+    avoids the ABA problem without double-width compare-and-swap. Memory is never returned to the
+    system; blocks and magazines are recycled for the life of the program.
+
+    Once a thread's cache has been destroyed, blocks it allocates or deallocates, such as those of
+    thread_local or static objects destroyed later, go directly to and from the depot.
+*/
+template <std::size_t Size>
+class pool {
+    static constexpr std::size_t magazine_capacity = 64;
+
+    struct magazine {
+        magazine* _next{nullptr};
+        std::size_t _count{0};
+        void* _blocks[magazine_capacity];
+
+        [[nodiscard]] auto empty() const noexcept -> bool { return _count == 0; }
+        [[nodiscard]] auto full() const noexcept -> bool { return _count == magazine_capacity; }
+        auto pop() noexcept -> void* { return _blocks[--_count]; }
+        void push(void* p) noexcept { _blocks[_count++] = p; }
+    };
+
+    class list {
+        std::atomic<magazine*> _head{nullptr};
+
+        void push_chain(magazine* first, magazine* last) noexcept {
+            magazine* head = _head.load(std::memory_order_relaxed);
+            do {
+                last->_next = head;
+            } while (!_head.compare_exchange_weak(head, first, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+        }
+
+    public:
+        void push(magazine* m) noexcept { push_chain(m, m); }
+
+        auto pop() noexcept -> magazine* {
+            magazine* first = _head.exchange(nullptr, std::memory_order_acquire);
+            if (!first) return nullptr;
+            if (magazine* rest = first->_next) {
+                // Put the remainder back as the whole list. Only magazines pushed since the list
+                // was taken are then walked, to be pushed again after it.
+                if (magazine* pushed = _head.exchange(rest, std::memory_order_acq_rel)) {
+                    magazine* last = pushed;
+                    while (last->_next)
+                        last = last->_next;
+                    push_chain(pushed, last);
+                }
+            }
+            first->_next = nullptr;
+            return first;
+        }
+    };
+
+    struct depot {
+        list _full;
+        list _empty;
+    };
+
+    static auto global() noexcept -> depot& {
+        static depot depot_s;
+        return depot_s;
+    }
+
+    struct cache {
+        magazine* _loaded{nullptr};
+        magazine* _previous{nullptr};
+
+        cache() { (void)global(); } // ensure the depot outlives the cache
+
+        cache(const cache&) = delete;
+        auto operator=(const cache&) -> cache& = delete;
+
+        ~cache() {
+            release(std::exchange(_loaded, nullptr));
+            release(std::exchange(_previous, nullptr));
+            torn_down() = true;
+        }
+
+        static void release(magazine* m) noexcept {
+            if (!m) return;
+            if (m->empty()) {
+                global()._empty.push(m);
+            } else {
+                global()._full.push(m);
+            }
+        }
+    };
+
+    static auto local() noexcept -> cache& {
+        thread_local cache cache_s;
+        return cache_s;
+    }
+
+    /// True once the calling thread's cache has been destroyed. Being trivially destructible, the
+    /// flag remains usable by destructors run after the cache's.
+    static auto torn_down() noexcept -> bool& {
+        thread_local bool torn_down_s = false;
+        return torn_down_s;
+    }
+
+    static auto empty_magazine() noexcept -> magazine* {
+        if (magazine* m = global()._empty.pop()) return m;
+        return new (std::nothrow) magazine;
+    }
+
+    static auto fresh_magazine() -> magazine* {
+        auto* m = empty_magazine();
+        if (!m) throw std::bad_alloc();
+        unsigned char* chunk = nullptr;
+        try {
+            chunk = static_cast<unsigned char*>(::operator new(Size * magazine_capacity));
+        } catch (...) {
+            global()._empty.push(m);
+            throw;
+        }
+        for (std::size_t i = 0; i != magazine_capacity; ++i)
+            m->push(chunk + i * Size);
+        return m;
+    }
+
+    static auto allocate_from_depot() -> void* {
+        magazine* m = global()._full.pop();
+        if (!m) m = fresh_magazine();
+        void* p = m->pop();
+        cache::release(m);
+        return p;
+    }
+
+    static void deallocate_to_depot(void* p) noexcept {
+        magazine* m = empty_magazine();
+        if (!m) return;
+        m->push(p);
+        cache::release(m);
+    }
+
+public:
+    static auto allocate() -> void* {
+        if (torn_down()) return allocate_from_depot();
+        cache& c = local();
+        if (c._loaded && !c._loaded->empty()) return c._loaded->pop();
+        if (c._previous && !c._previous->empty()) {
+            std::swap(c._loaded, c._previous);
+            return c._loaded->pop();
+        }
+        magazine* m = global()._full.pop();
+        if (!m) m = fresh_magazine();
+        cache::release(c._previous);
+        c._previous = c._loaded;
+        c._loaded = m;
+        return c._loaded->pop();
+    }
+
+    /*
+        If no magazine can be obtained to hold `p` the block is leaked rather than failing, since
+        deallocation cannot report an error.
+    */
+    static void deallocate(void* p) noexcept {
+        if (torn_down()) {
+            deallocate_to_depot(p);
+            return;
+        }
+        cache& c = local();
+        if (c._loaded && !c._loaded->full()) {
+            c._loaded->push(p);
+            return;
+        }
+        if (c._previous && !c._previous->full()) {
+            std::swap(c._loaded, c._previous);
+            c._loaded->push(p);
+            return;
+        }
+        magazine* m = empty_magazine();
+        if (!m) return;
+        cache::release(c._previous);
+        c._previous = c._loaded;
+        c._loaded = m;
+        c._loaded->push(p);
+    }
+};
+
+/**************************************************************************************************/
+
+} // namespace detail
+
+/**************************************************************************************************/
+
+/*!
+    A stateless allocator that serves single-object allocations from a per-size pool.
+
+    Sizes are rounded up to a multiple of `alignof(std::max_align_t)` and each size class has its
+    own pool, so all `pool_allocator` instances which rebind to types of the same size class share
+    blocks. Requests for more than one object, for over-aligned types, or for objects larger than
+    `max_pooled_size` are forwarded to `::operator new`.
+
+    Blocks may be deallocated on a different thread than the one that allocated them. Memory held by
+    the pools is not returned to the system.
+
+    Typical use is with stlab::allocate_copy_on_write:
+
+    @code
+    auto x = stlab::allocate_copy_on_write<document>(stlab::pool_allocator<document>());
+    @endcode
+*/
+template <class T>
+class pool_allocator {
+    static constexpr std::size_t granule = alignof(std::max_align_t);
+    static constexpr std::size_t size_class = (sizeof(T) + granule - 1) / granule * granule;
+
+public:
+    /*!
+        @brief Blocks larger than this are not pooled.
+    */
+    static constexpr std::size_t max_pooled_size = 4096;
+
+    using value_type = T;
+    using is_always_equal = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+
+    pool_allocator() noexcept = default;
+
+    template <class U>
+    pool_allocator(const pool_allocator<U>&) noexcept {}
+
+    [[nodiscard]] auto allocate(std::size_t n) -> T* {
+        if constexpr (pooled()) {
+            if (n == 1) return static_cast<T*>(detail::pool<size_class>::allocate());
+        }
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+        } else {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if constexpr (pooled()) {
+            if (n == 1) {
+                detail::pool<size_class>::deallocate(p);
+                return;
+            }
+        }
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(p, std::align_val_t{alignof(T)});
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    template <class U>
+    friend auto operator==(const pool_allocator&, const pool_allocator<U>&) noexcept -> bool {
+        return true;
+    }
+
+    template <class U>
+    friend auto operator!=(const pool_allocator&, const pool_allocator<U>&) noexcept -> bool {
+        return false;
+    }
+
+private:
+    static constexpr auto pooled() noexcept -> bool {
+        return alignof(T) <= granule && size_class <= max_pooled_size;
+    }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
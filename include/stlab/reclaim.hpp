@@ -0,0 +1,431 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file reclaim.hpp
+    @brief Deferred reclamation policies for copy_on_write
+
+    This file contains the reclamation policies for stlab::copy_on_write, which change when and
+    where a model is destroyed after its last reference is released, and
+    stlab::reclaim::epoch_guard, which lets readers use a value without holding a reference to it.
+*/
+
+#ifndef STLAB_RECLAIM_HPP
+#define STLAB_RECLAIM_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+#include <stlab/size_of.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+namespace detail {
+
+/**************************************************************************************************/
+
+/*
+    A process wide epoch based reclamation domain.
+
+    Each thread which pins has a record holding the epoch it pinned, or zero. The global epoch
+    advances once every pinned thread has observed it, and an object retired in epoch `e` is freed
+    once the global epoch reaches `e + 2`, when no thread can still be pinned in an epoch which
+    could have seen it. Pinning and unpinning touch only the thread's own record.
+
+    Retired objects are kept in one list per epoch. Since the global epoch advances one step at a
+    time, only three lists are ever live, and a whole list becomes safe at once. Retiring takes a
+    lock and appends to the list of the current epoch; every `collect_interval` retires it also
+    tries to advance the epoch and frees the lists which have become safe, so the cost of a retire
+    does not depend on the number of objects pending.
+
+    The domain and the records are never destroyed, so handles with static storage duration may
+    be released at any point during program termination.
+*/
+class epoch_domain {
+public:
+    using destroy_fn = void (*)(void*) noexcept;
+
+private:
+    struct record {
+        std::atomic<std::uint64_t> _epoch{0};
+        std::atomic<bool> _in_use{true};
+        record* _next{nullptr};
+        std::size_t _depth{0}; // nested pins, only accessed by the owning thread
+    };
+
+    struct retired {
+        void* _object;
+        destroy_fn _destroy;
+    };
+
+    struct retire_list {
+        std::uint64_t _epoch{0};
+        std::vector<retired> _objects;
+    };
+
+    static constexpr std::size_t collect_interval = 64;
+
+    std::atomic<std::uint64_t> _global{1};
+    std::atomic<record*> _records{nullptr};
+    std::mutex _mutex;
+    retire_list _retired[3];                  // indexed by epoch modulo 3
+    std::size_t _pending{0};                  // objects in _retired
+    std::size_t _countdown{collect_interval}; // retires until the next collection
+
+    auto acquire_record() -> record* {
+        for (record* r = _records.load(std::memory_order_acquire); r; r = r->_next) {
+            bool expected = false;
+            if (r->_in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return r;
+        }
+        auto* r = new record;
+        r->_next = _records.load(std::memory_order_relaxed);
+        while (!_records.compare_exchange_weak(r->_next, r, std::memory_order_release,
+                                               std::memory_order_relaxed)) {}
+        return r;
+    }
+
+    struct thread_record {
+        record* _record;
+
+        thread_record() : _record(instance().acquire_record()) {}
+        thread_record(const thread_record&) = delete;
+        auto operator=(const thread_record&) -> thread_record& = delete;
+        ~thread_record() { _record->_in_use.store(false, std::memory_order_release); }
+    };
+
+    static auto local() -> record& {
+        thread_local thread_record record_s;
+        return *record_s._record;
+    }
+
+    // Requires _mutex. Advances the global epoch if every pinned thread has observed it.
+    void try_advance() noexcept {
+        std::uint64_t g = _global.load(std::memory_order_seq_cst);
+        for (record* r = _records.load(std::memory_order_acquire); r; r = r->_next) {
+            std::uint64_t e = r->_epoch.load(std::memory_order_seq_cst);
+            if (e != 0 && e != g) return;
+        }
+        _global.compare_exchange_strong(g, g + 1, std::memory_order_seq_cst);
+    }
+
+    // Requires _mutex. Moves the objects of `list` to `ready`; `ready` is unchanged on failure.
+    void take(retire_list& list, std::vector<retired>& ready) {
+        const std::size_t n = list._objects.size();
+        if (ready.empty()) {
+            ready.swap(list._objects);
+        } else {
+            ready.insert(ready.end(), list._objects.begin(), list._objects.end());
+            list._objects.clear();
+        }
+        _pending -= n;
+    }
+
+    // Requires _mutex. Moves the objects which are safe to free to `ready`.
+    void take_ready(std::vector<retired>& ready) {
+        const std::uint64_t g = _global.load(std::memory_order_seq_cst);
+        for (auto& list : _retired) {
+            if (!list._objects.empty() && list._epoch + 2 <= g) take(list, ready);
+        }
+    }
+
+    static void free(const std::vector<retired>& ready) noexcept {
+        for (const auto& e : ready)
+            e._destroy(e._object);
+    }
+
+    // Waits until no thread is pinned in an epoch before the current one.
+    void wait_for_readers() noexcept {
+        const std::uint64_t g = _global.fetch_add(1, std::memory_order_seq_cst) + 1;
+        for (record* r = _records.load(std::memory_order_acquire); r; r = r->_next) {
+            for (;;) {
+                std::uint64_t e = r->_epoch.load(std::memory_order_seq_cst);
+                if (e == 0 || e >= g) break;
+                std::this_thread::yield();
+            }
+        }
+    }
+
+public:
+    static auto instance() -> epoch_domain& {
+        static epoch_domain* domain_s = new epoch_domain;
+        return *domain_s;
+    }
+
+    static void pin() {
+        record& r = local();
+        if (r._depth++ != 0) return;
+        r._epoch.store(instance()._global.load(std::memory_order_seq_cst),
+                       std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    static void unpin() noexcept {
+        record& r = local();
+        assert(r._depth != 0 && "unpin without pin");
+        if (--r._depth == 0) r._epoch.store(0, std::memory_order_release);
+    }
+
+    static auto pinned() -> bool { return local()._depth != 0; }
+
+    /*
+        Frees `object` with `destroy` once no pinned thread can be using it. If the object cannot
+        be queued for lack of memory, waits for the pinned threads instead.
+    */
+    void retire(void* object, destroy_fn destroy) noexcept {
+        std::vector<retired> ready;
+        bool queued = true;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            const std::uint64_t g = _global.load(std::memory_order_seq_cst);
+            retire_list& list = _retired[g % 3];
+            // A list last used three or more epochs ago is safe to free.
+            if (list._epoch != g) {
+                take(list, ready);
+                list._epoch = g;
+            }
+            try {
+                list._objects.push_back({object, destroy});
+                ++_pending;
+            } catch (...) {
+                queued = false;
+            }
+            if (--_countdown == 0) {
+                _countdown = collect_interval;
+                try_advance();
+                try {
+                    take_ready(ready);
+                } catch (...) {
+                    // Leave the objects queued for a later retire or collect.
+                }
+            }
+        }
+        if (!queued) {
+            wait_for_readers();
+            destroy(object);
+        }
+        free(ready);
+    }
+
+    /*
+        Frees the retired objects which have become safe, returning the number still pending.
+    */
+    auto collect() noexcept -> std::size_t {
+        std::vector<retired> ready;
+        std::size_t pending = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            try_advance();
+            try {
+                take_ready(ready);
+            } catch (...) {
+                // Leave the objects queued for a later retire or collect.
+            }
+            pending = _pending;
+        }
+        free(ready);
+        return pending;
+    }
+
+    /*
+        Frees every object retired before the call, waiting for pinned threads as needed.
+    */
+    void synchronize() noexcept {
+        assert(!pinned() && "synchronize called by a pinned thread");
+        while (collect() != 0)
+            std::this_thread::yield();
+    }
+};
+
+/**************************************************************************************************/
+
+/*
+    A single, lazily started thread which runs queued tasks in order. Like the epoch domain it is
+    never destroyed; the thread is detached and any tasks still queued at exit are abandoned.
+*/
+class background_reclaimer {
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::condition_variable _idle;
+    std::deque<std::function<void()>> _tasks;
+    bool _running{false};
+    bool _started{false};
+
+    void run() noexcept {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _ready.wait(lock, [&] { return !_tasks.empty(); });
+            std::function<void()> task = std::move(_tasks.front());
+            _tasks.pop_front();
+            _running = true;
+            lock.unlock();
+            task();
+            lock.lock();
+            _running = false;
+            if (_tasks.empty()) _idle.notify_all();
+        }
+    }
+
+public:
+    static auto instance() -> background_reclaimer& {
+        static background_reclaimer* reclaimer_s = new background_reclaimer;
+        return *reclaimer_s;
+    }
+
+    void push(std::function<void()> task) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_started) {
+            std::thread([this] { run(); }).detach();
+            _started = true;
+        }
+        _tasks.push_back(std::move(task));
+        _ready.notify_one();
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [&] { return _tasks.empty() && !_running; });
+    }
+};
+
+/**************************************************************************************************/
+
+template <class Policy, class = void>
+constexpr bool is_epoch_reclaimed_v = false;
+
+template <class Policy>
+constexpr bool is_epoch_reclaimed_v<Policy, std::void_t<decltype(Policy::epoch_reclaimed)>> =
+    Policy::epoch_reclaimed;
+
+/**************************************************************************************************/
+
+} // namespace detail
+
+/**************************************************************************************************/
+
+/*!
+    Reclamation policies for stlab::copy_on_write.
+
+    By default a model is destroyed by the thread which releases its last reference. A
+    reclamation policy may instead defer the destruction.
+*/
+namespace reclaim {
+
+/*!
+    Defers the destruction of released models until no thread is inside an epoch_guard which
+    began before the release. This lets readers of an atomic_copy_on_write borrow() the published
+    value, pinning it without touching its reference count.
+*/
+template <class Base = threading::multi>
+struct epoch : Base {
+    static constexpr bool epoch_reclaimed = true;
+
+    template <class T>
+    static void reclaim(const T&, void* model, void (*destroy)(void*) noexcept) noexcept {
+        detail::epoch_domain::instance().retire(model, destroy);
+    }
+};
+
+/*!
+    The default executor of reclaim::deferred: runs tasks in order on a single background thread,
+    started on first use.
+*/
+struct background_executor {
+    template <class F>
+    void operator()(F&& f) const {
+        detail::background_reclaimer::instance().push(std::forward<F>(f));
+    }
+
+    /*!
+        @brief Blocks until every task submitted so far has run.
+    */
+    static void wait_idle() { detail::background_reclaimer::instance().wait_idle(); }
+};
+
+/*!
+    Destroys released models whose values occupy at least `Threshold` bytes, as measured by
+    default_size_of, by submitting the destruction to `Executor`, so freeing a large value does not
+    stall the thread which releases it. Smaller models are reclaimed by `Base` directly.
+
+    `Executor` is a default constructible function object taking a nullary callable, such as an
+    executor of a task system; its tasks then run `Base`'s reclamation. If the executor throws,
+    the model is reclaimed on the calling thread.
+*/
+template <std::size_t Threshold = (std::size_t{1} << 20),
+          class Base = threading::multi,
+          class Executor = background_executor>
+struct deferred : Base {
+    static constexpr std::size_t threshold = Threshold;
+
+    template <class T>
+    static void reclaim(const T& value, void* model, void (*destroy)(void*) noexcept) noexcept {
+        if (default_size_of<T>{}(value) >= Threshold) {
+            try {
+                Executor{}([v = &value, model, destroy] { Base::reclaim(*v, model, destroy); });
+                return;
+            } catch (...) {
+            }
+        }
+        Base::reclaim(value, model, destroy);
+    }
+};
+
+/*!
+    Pins the current thread for its lifetime, so no model released under the reclaim::epoch
+    policy after the guard was constructed is destroyed until the guard is destroyed. Guards may
+    be nested. A guard must be destroyed on the thread that constructed it.
+*/
+class epoch_guard {
+public:
+    epoch_guard() { detail::epoch_domain::pin(); }
+    epoch_guard(const epoch_guard&) = delete;
+    auto operator=(const epoch_guard&) -> epoch_guard& = delete;
+    ~epoch_guard() { detail::epoch_domain::unpin(); }
+};
+
+/*!
+    @brief Destroys the released models which are no longer reachable by any pinned thread, and
+   returns the number still deferred.
+
+    Deferred models are otherwise destroyed as later models are released.
+*/
+inline auto collect() noexcept -> std::size_t { return detail::epoch_domain::instance().collect(); }
+
+/*!
+    @brief Destroys every model released before the call, waiting for pinned threads to unpin.
+   Must not be called from inside an epoch_guard.
+*/
+inline void synchronize() noexcept { detail::epoch_domain::instance().synchronize(); }
+
+} // namespace reclaim
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
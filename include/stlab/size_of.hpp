@@ -0,0 +1,69 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file size_of.hpp
+    @brief Estimates of the memory held by a value
+
+    This file contains stlab::default_size_of, the function object used by the memory budgeted
+    utilities to estimate how many bytes a value occupies.
+*/
+
+#ifndef STLAB_SIZE_OF_HPP
+#define STLAB_SIZE_OF_HPP
+
+/**************************************************************************************************/
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+namespace detail {
+
+template <class T, class = void>
+constexpr bool has_capacity_v = false;
+
+template <class T>
+constexpr bool has_capacity_v<
+    T, std::void_t<decltype(std::declval<const T&>().capacity()), typename T::value_type>> = true;
+
+} // namespace detail
+
+/**************************************************************************************************/
+
+/*!
+    Returns `sizeof(T)`, plus `capacity() * sizeof(value_type)` for types with a `capacity()`
+    member such as `std::vector` and `std::string`. Memory owned by the elements themselves is not
+    counted; supply a custom function object where that matters.
+*/
+template <class T>
+struct default_size_of {
+    auto operator()(const T& x) const noexcept -> std::size_t {
+        if constexpr (detail::has_capacity_v<T>) {
+            return sizeof(T) + x.capacity() * sizeof(typename T::value_type);
+        } else {
+            (void)x;
+            return sizeof(T);
+        }
+    }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
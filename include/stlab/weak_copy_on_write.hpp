@@ -0,0 +1,152 @@
+/*
+    Copyright 2013 Adobe
+    Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+*/
+/**************************************************************************************************/
+
+/*!
+    @file weak_copy_on_write.hpp
+    @brief Weak references to copy_on_write values
+
+    This file contains stlab::weak_copy_on_write, which refers to the value of a copy_on_write
+    without keeping it alive, in the manner of `std::weak_ptr`.
+*/
+
+#ifndef STLAB_WEAK_COPY_ON_WRITE_HPP
+#define STLAB_WEAK_COPY_ON_WRITE_HPP
+
+/**************************************************************************************************/
+
+#include <stlab/copy_on_write.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/**************************************************************************************************/
+
+namespace stlab {
+
+/**************************************************************************************************/
+
+/*!
+    A weak reference to the value of a `copy_on_write<T, Policy>`. It does not keep the value
+    alive, and lock() returns a handle to the value if it still exists and has not been modified.
+
+    This allows a cache of results derived from values to be keyed on identity(): an entry holding
+    a weak handle can be matched against a value with identity(x), which is false once the value it
+    was made from is gone even if a new model reuses the address, and dropped once expired().
+    Since a value is only modified in place once its weak handles have expired, a matching entry
+    is current.
+
+    `Policy` must enable references::weak and must not store values inline. Concurrent use of
+    different weak handles, and of the handles they were made from, is safe.
+*/
+template <class T, class Policy = references::weak<>>
+class weak_copy_on_write {
+public:
+    using value_type = copy_on_write<T, Policy>;
+
+private:
+    using model = typename value_type::model;
+
+    static_assert(Policy::weak_references,
+                  "weak_copy_on_write requires the references::weak policy");
+    static_assert(!value_type::is_inline, "weak_copy_on_write requires shared storage");
+
+    detail::weak_anchor* _anchor{nullptr};
+
+    static auto anchor(const value_type& x) -> detail::weak_anchor* {
+        assert(x._self && "FATAL (sparent) : using a moved copy_on_write object");
+
+        return x._self->acquire_anchor(x._self);
+    }
+
+    auto target() const noexcept -> void* {
+        return _anchor ? _anchor->_target.load(std::memory_order_acquire) : nullptr;
+    }
+
+public:
+    /*!
+        @brief Constructs an empty weak handle, which is always expired.
+    */
+    weak_copy_on_write() noexcept = default;
+
+    /*!
+        @brief Constructs a weak handle to the value of `x`.
+    */
+    weak_copy_on_write(const value_type& x) : _anchor(anchor(x)) {}
+
+    weak_copy_on_write(const weak_copy_on_write& x) noexcept : _anchor(x._anchor) {
+        if (_anchor) _anchor->increment();
+    }
+
+    weak_copy_on_write(weak_copy_on_write&& x) noexcept :
+        _anchor(std::exchange(x._anchor, nullptr)) {}
+
+    ~weak_copy_on_write() {
+        if (_anchor) _anchor->release();
+    }
+
+    auto operator=(const weak_copy_on_write& x) noexcept -> weak_copy_on_write& {
+        return *this = weak_copy_on_write(x);
+    }
+
+    auto operator=(weak_copy_on_write&& x) noexcept -> weak_copy_on_write& {
+        auto tmp{std::move(x)};
+        swap(*this, tmp);
+        return *this;
+    }
+
+    /*!
+        @brief Returns a handle to the value, or nothing if it has been destroyed or modified.
+    */
+    [[nodiscard]] auto lock() const noexcept -> std::optional<value_type> {
+        if (!_anchor) return std::nullopt;
+
+        std::lock_guard<std::mutex> lock(_anchor->_mutex);
+        auto* m = static_cast<model*>(_anchor->_target.load(std::memory_order_relaxed));
+        if (!m) return std::nullopt;
+        if (!value_type::is_default(m) && !m->_count.try_increment()) return std::nullopt;
+        return value_type(typename value_type::adopt_t{}, m);
+    }
+
+    /*!
+        @brief Returns true if the value has been destroyed or modified. A false result may be
+       stale by the time it is used, since another thread may release or write the last handle.
+    */
+    [[nodiscard]] auto expired() const noexcept -> bool { return !target(); }
+
+    /*!
+        @brief Returns true if `x` refers to the value this weak handle was made from.
+    */
+    [[nodiscard]] auto identity(const value_type& x) const noexcept -> bool {
+        assert(x._self && "FATAL (sparent) : using a moved copy_on_write object");
+
+        return target() == static_cast<void*>(x._self);
+    }
+
+    /*!
+        @brief Returns true if both weak handles were made from the same value, or are empty.
+    */
+    [[nodiscard]] auto identity(const weak_copy_on_write& x) const noexcept -> bool {
+        return _anchor == x._anchor;
+    }
+
+    friend inline void swap(weak_copy_on_write& x, weak_copy_on_write& y) noexcept {
+        std::swap(x._anchor, y._anchor);
+    }
+};
+
+/**************************************************************************************************/
+
+} // namespace stlab
+
+/**************************************************************************************************/
+
+#endif
+
+/**************************************************************************************************/
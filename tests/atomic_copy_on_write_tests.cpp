@@ -0,0 +1,152 @@
+#include <stlab/atomic_copy_on_write.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+using stlab::atomic_copy_on_write;
+using stlab::copy_on_write;
+
+namespace {
+
+// Counts live instances so leaks and double destruction are detected.
+struct tracked {
+    static inline std::atomic<int> live{0};
+    int _value = 0;
+
+    tracked() { ++live; }
+    explicit tracked(int x) : _value(x) { ++live; }
+    tracked(const tracked& x) : _value(x._value) { ++live; }
+    auto operator=(const tracked&) -> tracked& = default;
+    ~tracked() { --live; }
+};
+
+} // namespace
+
+TEST_CASE("atomic_copy_on_write single threaded") {
+    SUBCASE("default construction holds a default value") {
+        atomic_copy_on_write<int> a;
+        CHECK(*a.load() == 0);
+        CHECK(a.load().identity(copy_on_write<int>()));
+        CHECK(a.is_lock_free() == decltype(a)::is_always_lock_free);
+        CHECK_FALSE(a.is_lock_free());
+    }
+
+    SUBCASE("loads share the published value") {
+        copy_on_write<std::string> x("config");
+        atomic_copy_on_write<std::string> a(x);
+        for (int i = 0; i != 100; ++i) {
+            auto y = a.load();
+            CHECK(y.identity(x));
+        }
+        x = copy_on_write<std::string>();
+        std::vector<copy_on_write<std::string>> snapshots;
+        for (int i = 0; i != 100; ++i)
+            snapshots.push_back(a.load());
+        CHECK(*snapshots.back() == "config");
+    }
+
+    SUBCASE("padded models take larger batches") {
+        using policy = stlab::layout::padded<>;
+        copy_on_write<int, policy> x(7);
+        atomic_copy_on_write<int, policy> a(x);
+        std::vector<copy_on_write<int, policy>> snapshots;
+        for (int i = 0; i != 200; ++i)
+            snapshots.push_back(a.load());
+        CHECK(snapshots.back().identity(x));
+        a.store(copy_on_write<int, policy>(8));
+        snapshots.clear();
+        CHECK(x.unique());
+    }
+
+    SUBCASE("store and exchange") {
+        atomic_copy_on_write<std::string> a(copy_on_write<std::string>("one"));
+        auto first = a.load();
+        a.store(copy_on_write<std::string>("two"));
+        CHECK(*first == "one");
+        CHECK(first.unique());
+        CHECK(*a.load() == "two");
+
+        auto previous = a.exchange(copy_on_write<std::string>("three"));
+        CHECK(*previous == "two");
+        CHECK(previous.unique());
+        CHECK(*a.load() == "three");
+
+        a = copy_on_write<std::string>();
+        CHECK(a.load()->empty());
+    }
+
+    SUBCASE("compare_exchange compares identity") {
+        atomic_copy_on_write<std::string> a(copy_on_write<std::string>("one"));
+        auto expected = a.load();
+        copy_on_write<std::string> other("one"); // equal but not identical
+
+        CHECK_FALSE(a.compare_exchange(other, copy_on_write<std::string>("two")));
+        CHECK(other.identity(expected));
+        CHECK(*a.load() == "one");
+
+        CHECK(a.compare_exchange(expected, copy_on_write<std::string>("two")));
+        CHECK(*a.load() == "two");
+        CHECK(*expected == "one");
+        other = copy_on_write<std::string>();
+        CHECK(expected.unique());
+    }
+
+    SUBCASE("references are released") {
+        {
+            atomic_copy_on_write<tracked> a(copy_on_write<tracked>(tracked(1)));
+            for (int i = 0; i != 50; ++i) {
+                auto x = a.load();
+                if (i % 7 == 0) a.store(copy_on_write<tracked>(tracked(i)));
+                if (i % 11 == 0) (void)a.exchange(x);
+            }
+            auto e = a.load();
+            CHECK(a.compare_exchange(e, copy_on_write<tracked>(tracked(-1))));
+        }
+        CHECK(tracked::live == 0);
+    }
+}
+
+TEST_CASE("atomic_copy_on_write concurrent readers and writers") {
+    {
+        atomic_copy_on_write<tracked> a(copy_on_write<tracked>(tracked(0)));
+        std::atomic<bool> done{false};
+        std::atomic<bool> ordered{true};
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t != 4; ++t) {
+            readers.emplace_back([&] {
+                int last = 0;
+                while (!done.load(std::memory_order_relaxed)) {
+                    auto x = a.load();
+                    if (x->_value < last) ordered = false;
+                    last = x->_value;
+                }
+            });
+        }
+
+        std::thread writer([&] {
+            for (int i = 1; i != 5000; ++i) {
+                if (i % 2) {
+                    a.store(copy_on_write<tracked>(tracked(i)));
+                } else {
+                    auto expected = a.load();
+                    while (!a.compare_exchange(expected, copy_on_write<tracked>(tracked(i)))) {}
+                }
+            }
+            done = true;
+        });
+
+        writer.join();
+        for (auto& e : readers)
+            e.join();
+        CHECK(ordered);
+        CHECK(a.load()->_value == 4999);
+    }
+    CHECK(tracked::live == 0);
+}
@@ -0,0 +1,103 @@
+#define STLAB_COPY_ON_WRITE_INSTRUMENTATION 1
+#include <stlab/copy_on_write.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+using stlab::copy_on_write;
+namespace instrumentation = stlab::instrumentation;
+
+namespace {
+
+std::size_t hook_calls = 0;
+bool hook_transform = false;
+
+void count_detach(const instrumentation::detach_info& info) noexcept {
+    if (info.type == typeid(std::string)) {
+        ++hook_calls;
+        hook_transform = info.transform;
+    }
+}
+
+} // namespace
+
+TEST_CASE("copy_on_write instrumentation") {
+    instrumentation::reset_statistics<std::string>();
+
+    SUBCASE("allocations and detaches") {
+        copy_on_write<std::string> cow1(std::string("hello"));
+        copy_on_write<std::string> cow2(cow1);
+
+        auto stats = instrumentation::statistics_for<std::string>();
+        CHECK(stats.allocations == 1);
+        CHECK(stats.detaches == 0);
+
+        cow2.write() += " world";
+        cow2.write() += "!"; // unique, so in place
+
+        stats = instrumentation::statistics_for<std::string>();
+        CHECK(stats.allocations == 2);
+        CHECK(stats.detaches == 1);
+        CHECK(stats.inplace_writes == 1);
+        CHECK(stats.bytes_copied == stlab::default_size_of<std::string>{}(*cow1));
+    }
+
+    SUBCASE("bytes copied include memory owned by the value") {
+        using vector = std::vector<int>;
+        instrumentation::reset_statistics<vector>();
+        copy_on_write<vector> cow1(vector(1 << 18, 1));
+        copy_on_write<vector> cow2(cow1);
+        cow2.write()[0] = 2;
+
+        auto stats = instrumentation::statistics_for<vector>();
+        CHECK(stats.detaches == 1);
+        CHECK(stats.bytes_copied == sizeof(vector) + cow1->capacity() * sizeof(int));
+        CHECK(stats.bytes_copied >= (1 << 20));
+    }
+
+    SUBCASE("transform detaches and in-place assignment") {
+        copy_on_write<std::string> cow1(std::string("hello"));
+        copy_on_write<std::string> cow2(cow1);
+
+        cow2.write([](const std::string& x) { return x + "!"; }, [](std::string& x) { x += "!"; });
+        cow2.write([](const std::string& x) { return x + "!"; }, [](std::string& x) { x += "!"; });
+        cow2 = std::string("assigned");
+
+        auto stats = instrumentation::statistics_for<std::string>();
+        CHECK(stats.transform_detaches == 1);
+        CHECK(stats.inplace_writes == 1);
+        CHECK(stats.inplace_assignments == 1);
+        CHECK(stats.allocations == 2);
+    }
+
+    SUBCASE("detach hook") {
+        hook_calls = 0;
+        auto previous = instrumentation::set_detach_hook(&count_detach);
+        CHECK(previous == nullptr);
+
+        copy_on_write<std::string> cow1(std::string("hello"));
+        copy_on_write<std::string> cow2(cow1);
+        cow2.write() = "world";
+        CHECK(hook_calls == 1);
+        CHECK_FALSE(hook_transform);
+
+        copy_on_write<std::string> cow3(cow2);
+        cow3.write([](const std::string& x) { return x; }, [](std::string&) {});
+        CHECK(hook_calls == 2);
+        CHECK(hook_transform);
+
+        CHECK(instrumentation::set_detach_hook(nullptr) == &count_detach);
+    }
+
+    SUBCASE("counts are per element type") {
+        instrumentation::reset_statistics<int>();
+        copy_on_write<int> cow(1);
+        CHECK(instrumentation::statistics_for<int>().allocations == 1);
+        CHECK(instrumentation::statistics_for<std::string>().allocations == 0);
+    }
+}
@@ -0,0 +1,211 @@
+#include <stlab/copy_on_write_intrusive.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using stlab::copy_on_write_intrusive;
+using stlab::intrusive_cow_counter;
+
+namespace {
+
+struct document : intrusive_cow_counter<document> {
+    static inline int instances = 0;
+
+    std::string _text;
+
+    document() { ++instances; }
+    explicit document(std::string text) : _text(std::move(text)) { ++instances; }
+    document(const document& x) : intrusive_cow_counter(x), _text(x._text) { ++instances; }
+    document(document&& x) noexcept : _text(std::move(x._text)) { ++instances; }
+    auto operator=(const document&) -> document& = default;
+    auto operator=(document&&) noexcept -> document& = default;
+    ~document() { --instances; }
+
+    friend auto operator==(const document& x, const document& y) -> bool {
+        return x._text == y._text;
+    }
+    friend auto operator<(const document& x, const document& y) -> bool {
+        return x._text < y._text;
+    }
+};
+
+// A type providing its own hooks rather than deriving from intrusive_cow_counter.
+struct handmade {
+    int _value{0};
+    mutable std::size_t _refs{0};
+
+    handmade() = default;
+    explicit handmade(int v) : _value(v) {}
+    handmade(const handmade& x) : _value(x._value) {}
+    auto operator=(const handmade& x) -> handmade& {
+        _value = x._value;
+        return *this;
+    }
+};
+
+void intrusive_cow_add_ref(const handmade* p) noexcept { ++p->_refs; }
+void intrusive_cow_release(const handmade* p) noexcept {
+    if (--p->_refs == 0) delete p;
+}
+auto intrusive_cow_use_count(const handmade* p) noexcept -> std::size_t { return p->_refs; }
+
+using handle = copy_on_write_intrusive<document>;
+
+// Stands in for a C API which hands a context pointer back to a callback.
+void invoke(void (*callback)(const void*), const void* context) { callback(context); }
+
+} // namespace
+
+TEST_CASE("copy_on_write_intrusive is a single pointer") {
+    CHECK(sizeof(handle) == sizeof(document*));
+}
+
+TEST_CASE("copy_on_write_intrusive shares until written") {
+    const int before = document::instances;
+    {
+        handle a(std::string("text"));
+        CHECK(a.unique());
+        CHECK(a->_text == "text");
+
+        handle b = a;
+        CHECK(a.identity(b));
+        CHECK_FALSE(a.unique());
+        CHECK(document::instances == before + 1);
+
+        b.write()._text = "changed";
+        CHECK_FALSE(a.identity(b));
+        CHECK(a.unique());
+        CHECK(b.unique());
+        CHECK(a->_text == "text");
+        CHECK(b->_text == "changed");
+        CHECK(document::instances == before + 2);
+
+        document* p = &b.write();
+        CHECK(p == b.get());
+
+        b.write([](const document& x) { return document(x._text + "!"); },
+                [](document& x) { x._text += "?"; });
+        CHECK(b->_text == "changed?");
+    }
+    CHECK(document::instances == before);
+}
+
+TEST_CASE("copy_on_write_intrusive default instances share a value") {
+    handle a;
+    handle b;
+    CHECK(a.identity(b));
+    CHECK_FALSE(a.unique());
+    CHECK(a->_text.empty());
+
+    a.write()._text = "written";
+    CHECK_FALSE(a.identity(b));
+    CHECK(b->_text.empty());
+}
+
+TEST_CASE("copy_on_write_intrusive assignment and take") {
+    handle a(std::string("one"));
+    const document* p = a.get();
+
+    a = document("two");
+    CHECK(a.get() == p);
+    CHECK(a->_text == "two");
+
+    handle b = a;
+    a = document("three");
+    CHECK(a.get() != p);
+    CHECK(b->_text == "two");
+
+    document taken = std::move(b).take();
+    CHECK(taken._text == "two");
+
+    handle c = a;
+    document copied = std::move(c).take();
+    CHECK(copied._text == "three");
+    CHECK(a->_text == "three");
+    CHECK(a.unique());
+}
+
+TEST_CASE("copy_on_write_intrusive recovers a handle from a raw pointer") {
+    handle a(std::string("context"));
+
+    SUBCASE("from_pointer adds a reference") {
+        static std::string seen;
+        invoke(
+            [](const void* context) {
+                auto h = handle::from_pointer(static_cast<const document*>(context));
+                CHECK_FALSE(h.unique());
+                seen = h->_text;
+            },
+            a.get());
+        CHECK(seen == "context");
+        CHECK(a.unique());
+    }
+
+    SUBCASE("release and adopt_pointer transfer a reference") {
+        handle b = a;
+        const document* raw = std::move(b).release();
+        CHECK_FALSE(a.unique());
+
+        handle c = handle::adopt_pointer(raw);
+        CHECK(c.identity(a));
+        c = handle();
+        CHECK(a.unique());
+    }
+}
+
+TEST_CASE("copy_on_write_intrusive comparisons") {
+    handle a(std::string("a"));
+    handle b(std::string("b"));
+    handle a2(std::string("a"));
+
+    CHECK(a == a2);
+    CHECK(a != b);
+    CHECK(a < b);
+    CHECK(b > a);
+    CHECK(a <= a2);
+    CHECK(a >= a2);
+    CHECK(a == document("a"));
+    CHECK(document("b") == b);
+    CHECK(a != document("b"));
+    CHECK_FALSE(a < a);
+}
+
+TEST_CASE("copy_on_write_intrusive with user supplied hooks") {
+    copy_on_write_intrusive<handmade> a(42);
+    auto b = a;
+    CHECK(a.get()->_refs == 2);
+
+    b.write()._value = 7;
+    CHECK(a->_value == 42);
+    CHECK(b->_value == 7);
+    CHECK(a.unique());
+}
+
+TEST_CASE("copy_on_write_intrusive copies are thread safe") {
+    const int before = document::instances;
+    {
+        handle shared(std::string("shared"));
+        std::atomic<int> mismatches{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t != 4; ++t) {
+            threads.emplace_back([shared, &mismatches] {
+                for (int i = 0; i != 1000; ++i) {
+                    handle copy = shared;
+                    if (copy->_text != "shared") ++mismatches;
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        CHECK(mismatches == 0);
+        CHECK(shared.unique());
+    }
+    CHECK(document::instances == before);
+}
@@ -3,12 +3,106 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+
 using stlab::copy_on_write;
 
+namespace {
+
+struct allocation_counts {
+    std::size_t allocations = 0;
+    std::size_t deallocations = 0;
+};
+
+template <class T>
+struct counting_allocator {
+    using value_type = T;
+
+    allocation_counts* _counts;
+
+    explicit counting_allocator(allocation_counts& counts) noexcept : _counts(&counts) {}
+
+    template <class U>
+    counting_allocator(const counting_allocator<U>& x) noexcept : _counts(x._counts) {}
+
+    auto allocate(std::size_t n) -> T* {
+        ++_counts->allocations;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        ++_counts->deallocations;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <class U>
+    friend auto operator==(const counting_allocator& x, const counting_allocator<U>& y) noexcept
+        -> bool {
+        return x._counts == y._counts;
+    }
+
+    template <class U>
+    friend auto operator!=(const counting_allocator& x, const counting_allocator<U>& y) noexcept
+        -> bool {
+        return !(x == y);
+    }
+};
+
+// Throws on copy once `copies_left` reaches zero.
+struct throwing_copy {
+    static inline int copies_left = 0;
+    int _value = 0;
+
+    throwing_copy() = default;
+    explicit throwing_copy(int x) : _value(x) {}
+    throwing_copy(const throwing_copy& x) : _value(x._value) {
+        if (copies_left-- == 0) throw std::runtime_error("copy failed");
+    }
+    throwing_copy(throwing_copy&&) noexcept = default;
+    auto operator=(const throwing_copy&) -> throwing_copy& = default;
+    auto operator=(throwing_copy&&) noexcept -> throwing_copy& = default;
+};
+
+// A key whose std::hash counts its calls.
+struct counted_key {
+    static inline int hashes = 0;
+    int _value = 0;
+
+    friend auto operator==(const counted_key& x, const counted_key& y) -> bool {
+        return x._value == y._value;
+    }
+};
+
+struct unhashable {};
+
+} // namespace
+
+namespace std {
+
+template <>
+struct hash<counted_key> {
+    auto operator()(const counted_key& x) const noexcept -> std::size_t {
+        ++counted_key::hashes;
+        return std::hash<int>{}(x._value);
+    }
+};
+
+} // namespace std
+
 TEST_CASE("copy_on_write basic construction") {
     SUBCASE("default construction") {
         copy_on_write<int> cow;
@@ -18,6 +112,15 @@ TEST_CASE("copy_on_write basic construction") {
         CHECK(cow.identity(cow2));
     }
 
+    SUBCASE("default construction is never unique") {
+        copy_on_write<std::string> cow;
+        CHECK_FALSE(cow.unique());
+
+        cow.write() = "hello";
+        CHECK(cow.unique());
+        CHECK(*copy_on_write<std::string>() == ""); // the shared default is unchanged
+    }
+
     SUBCASE("value construction") {
         copy_on_write<int> cow(42);
         CHECK(*cow == 42);
@@ -68,12 +171,14 @@ TEST_CASE("copy_on_write copy semantics") {
         copy_on_write<int> cow2(cow1);
 
         CHECK(cow1.identity(cow2));
+        CHECK(cow1.identity() == cow2.identity());
 
         cow2.write() = 100; // This should trigger copy-on-write
 
         CHECK(*cow1 == 42);
         CHECK(*cow2 == 100);
         CHECK_FALSE(cow1.identity(cow2)); // no longer the same data
+        CHECK(cow1.identity() != cow2.identity());
         CHECK(cow1.unique());
         CHECK(cow2.unique());
     }
@@ -258,3 +363,713 @@ TEST_CASE("copy_on_write with complex types") {
     CHECK(cow2->value == 42);
     CHECK_FALSE(cow.identity(cow2));
 }
+
+TEST_CASE("copy_on_write allocator support") {
+    allocation_counts counts;
+    counting_allocator<int> alloc(counts);
+
+    SUBCASE("allocator-extended construction") {
+        {
+            copy_on_write<std::vector<int>> cow(std::allocator_arg, alloc, 3, 7);
+            CHECK(cow->size() == 3);
+            CHECK((*cow)[0] == 7);
+            CHECK(cow.unique());
+            CHECK(counts.allocations == 1);
+        }
+        CHECK(counts.deallocations == 1);
+    }
+
+    SUBCASE("write detaches with the same allocator") {
+        {
+            auto cow1 = stlab::allocate_copy_on_write<std::string>(alloc, "hello");
+            copy_on_write<std::string> cow2(cow1);
+            CHECK(counts.allocations == 1);
+
+            cow2.write() += " world";
+            CHECK(counts.allocations == 2);
+            CHECK(*cow1 == "hello");
+            CHECK(*cow2 == "hello world");
+
+            copy_on_write<std::string> cow3(cow2);
+            cow3.write([](const std::string& s) { return s + "!"; },
+                       [](std::string& s) { s += "!"; });
+            CHECK(counts.allocations == 3);
+
+            copy_on_write<std::string> cow4(cow3);
+            cow4 = std::string("assigned");
+            CHECK(counts.allocations == 4);
+            CHECK(*cow3 == "hello world!");
+        }
+        CHECK(counts.deallocations == counts.allocations);
+    }
+
+#if __has_include(<memory_resource>)
+    SUBCASE("polymorphic allocator") {
+        std::pmr::monotonic_buffer_resource resource;
+        std::pmr::polymorphic_allocator<int> pmr_alloc(&resource);
+        auto cow = stlab::allocate_copy_on_write<int>(pmr_alloc, 42);
+        copy_on_write<int> cow2(cow);
+        cow2.write() = 7;
+        CHECK(*cow == 42);
+        CHECK(*cow2 == 7);
+    }
+#endif
+}
+
+TEST_CASE("copy_on_write single threaded policy") {
+    using cow_type = copy_on_write<std::string, stlab::threading::single>;
+
+    cow_type cow1(std::string("hello"));
+    CHECK(cow1.unique());
+
+    {
+        cow_type cow2(cow1);
+        CHECK(cow1.identity(cow2));
+        CHECK_FALSE(cow1.unique());
+
+        cow2.write() = "world";
+        CHECK(*cow1 == "hello");
+        CHECK(*cow2 == "world");
+        CHECK(cow2.unique());
+
+        cow_type cow3(cow1);
+        CHECK_FALSE(cow1.unique());
+    }
+
+    CHECK(cow1.unique());
+
+    cow_type empty1;
+    cow_type empty2;
+    CHECK(empty1.identity(empty2));
+    CHECK(*empty1 == "");
+
+    allocation_counts counts;
+    auto cow4 = stlab::allocate_copy_on_write<int, stlab::threading::single>(
+        counting_allocator<int>(counts), 42);
+    CHECK(*cow4 == 42);
+    CHECK(counts.allocations == 1);
+}
+
+TEST_CASE("copy_on_write padded layout") {
+    using cow_type = copy_on_write<int, stlab::layout::padded<>>;
+
+    auto aligned = [](const int& x) {
+        return reinterpret_cast<std::uintptr_t>(&x) % 64 == 0;
+    };
+
+    cow_type cow1(42);
+    CHECK(aligned(cow1.read()));
+
+    cow_type cow2(cow1);
+    cow2.write() = 7;
+    CHECK(aligned(cow2.read()));
+    CHECK(*cow1 == 42);
+    CHECK(*cow2 == 7);
+
+    cow_type empty;
+    CHECK(aligned(empty.read()));
+
+    allocation_counts counts;
+    auto cow3 =
+        stlab::allocate_copy_on_write<int, stlab::layout::padded<stlab::threading::single>>(
+            counting_allocator<int>(counts), 1);
+    CHECK(aligned(cow3.read()));
+}
+
+TEST_CASE("copy_on_write inline storage") {
+    SUBCASE("small trivially copyable values are stored inline") {
+        using cow_type = copy_on_write<int, stlab::storage::small_inline<>>;
+        static_assert(sizeof(cow_type) == sizeof(int));
+
+        cow_type cow1(42);
+        cow_type cow2(cow1);
+        CHECK(cow1.unique());
+        CHECK(cow2.unique());
+        CHECK_FALSE(cow1.identity(cow2));
+        CHECK(cow1.identity(cow1));
+        CHECK(cow1 == cow2);
+
+        cow2.write() = 7;
+        CHECK(*cow1 == 42);
+        CHECK(*cow2 == 7);
+
+        cow2.write([](const int& x) { return x + 1; }, [](int& x) { x += 2; });
+        CHECK(*cow2 == 9); // always unique, so always in place
+
+        cow1 = 3;
+        CHECK(*cow1 == 3);
+
+        swap(cow1, cow2);
+        CHECK(*cow1 == 9);
+        CHECK(*cow2 == 3);
+
+        cow_type empty;
+        CHECK(*empty == 0);
+
+        allocation_counts counts;
+        auto cow3 = stlab::allocate_copy_on_write<int, stlab::storage::small_inline<>>(
+            counting_allocator<int>(counts), 5);
+        CHECK(*cow3 == 5);
+        CHECK(counts.allocations == 0);
+    }
+
+    SUBCASE("other values are shared") {
+        using cow_type = copy_on_write<std::string, stlab::storage::small_inline<>>;
+        static_assert(sizeof(cow_type) == sizeof(void*));
+
+        cow_type cow1(std::string("hello"));
+        cow_type cow2(cow1);
+        CHECK(cow1.identity(cow2));
+    }
+
+    SUBCASE("always inline") {
+        using cow_type = copy_on_write<std::string, stlab::storage::always_inline<>>;
+
+        cow_type cow1(std::string("hello"));
+        cow_type cow2(cow1);
+        CHECK_FALSE(cow1.identity(cow2));
+
+        cow2.write() += " world";
+        CHECK(*cow1 == "hello");
+        CHECK(*cow2 == "hello world");
+
+        cow_type cow3(std::move(cow2));
+        CHECK(*cow3 == "hello world");
+        CHECK(cow3->size() == 11);
+    }
+}
+
+TEST_CASE("copy_on_write take") {
+    SUBCASE("unique value is moved out") {
+        copy_on_write<std::vector<int>> cow(std::vector<int>{1, 2, 3});
+        const int* data = cow->data();
+
+        std::vector<int> value = std::move(cow).take();
+        CHECK(value == std::vector<int>{1, 2, 3});
+        CHECK(value.data() == data); // moved, not copied
+    }
+
+    SUBCASE("shared value is copied") {
+        copy_on_write<std::vector<int>> cow1(std::vector<int>{1, 2, 3});
+        copy_on_write<std::vector<int>> cow2(cow1);
+
+        std::vector<int> value = std::move(cow2).take();
+        CHECK(value == std::vector<int>{1, 2, 3});
+        CHECK(value.data() != cow1->data());
+        CHECK(cow1.unique());
+        CHECK(*cow1 == std::vector<int>{1, 2, 3});
+    }
+
+    SUBCASE("default value is copied") {
+        copy_on_write<std::string> cow;
+        CHECK(std::move(cow).take() == "");
+        CHECK(*copy_on_write<std::string>() == "");
+    }
+
+    SUBCASE("moved-from object can be assigned") {
+        copy_on_write<std::string> cow(std::string("hello"));
+        CHECK(std::move(cow).take() == "hello");
+        cow = std::string("world");
+        CHECK(*cow == "world");
+    }
+
+    SUBCASE("inline value") {
+        copy_on_write<std::string, stlab::storage::always_inline<>> cow(std::string("hello"));
+        CHECK(std::move(cow).take() == "hello");
+    }
+}
+
+TEST_CASE("copy_on_write write_all") {
+    SUBCASE("detaches shared arguments and returns their values") {
+        copy_on_write<int> a(1);
+        copy_on_write<std::string> b("two");
+        copy_on_write<std::vector<int>> c(std::vector<int>{3});
+        auto a2 = a;
+        auto c2 = c;
+
+        auto [x, y, z] = stlab::write_all(a, b, c);
+        x = 10;
+        y += "!";
+        z.push_back(4);
+
+        CHECK(*a == 10);
+        CHECK(*a2 == 1);
+        CHECK(*b == "two!");
+        CHECK(*c == std::vector<int>{3, 4});
+        CHECK(*c2 == std::vector<int>{3});
+        CHECK(a.unique());
+        CHECK(c.unique());
+    }
+
+    SUBCASE("unique arguments are not copied") {
+        copy_on_write<std::string> a("a");
+        const void* before = a.identity();
+        auto [x] = stlab::write_all(a);
+        CHECK(&x == &*a);
+        CHECK(a.identity() == before);
+    }
+
+    SUBCASE("a throwing copy leaves every argument unchanged") {
+        copy_on_write<throwing_copy> a(throwing_copy(1));
+        copy_on_write<throwing_copy> b(throwing_copy(2));
+        auto a2 = a;
+        auto b2 = b;
+
+        throwing_copy::copies_left = 1;
+        CHECK_THROWS_AS(stlab::write_all(a, b), std::runtime_error);
+        CHECK(a.identity(a2));
+        CHECK(b.identity(b2));
+
+        throwing_copy::copies_left = 2;
+        auto [x, y] = stlab::write_all(a, b);
+        x._value = 10;
+        y._value = 20;
+        CHECK(a2->_value == 1);
+        CHECK(b2->_value == 2);
+        CHECK_FALSE(a.identity(a2));
+        CHECK_FALSE(b.identity(b2));
+    }
+
+    SUBCASE("unique arguments which cannot be written in place are copied first") {
+        using external = copy_on_write<throwing_copy, stlab::storage::external<>>;
+        const throwing_copy buffer(3);
+        external a(throwing_copy(1));
+        external b(stlab::external, buffer, [] {});
+        auto a2 = a;
+        REQUIRE(b.unique());
+        const void* before = b.identity();
+
+        throwing_copy::copies_left = 1;
+        CHECK_THROWS_AS(stlab::write_all(a, b), std::runtime_error);
+        CHECK(a.identity(a2));
+        CHECK(b.identity() == before);
+
+        throwing_copy::copies_left = 2;
+        auto [x, y] = stlab::write_all(a, b);
+        y._value = 30;
+        CHECK(buffer._value == 3);
+        CHECK(x._value == 1);
+    }
+
+    SUBCASE("values stored inline are written in place") {
+        copy_on_write<int, stlab::storage::small_inline<>> a(1);
+        copy_on_write<std::string, stlab::storage::always_inline<>> b(std::string("two"));
+        copy_on_write<std::string> c("three");
+        auto c2 = c;
+
+        auto [x, y, z] = stlab::write_all(a, b, c);
+        x = 10;
+        y += "!";
+        z += "!";
+
+        CHECK(&x == &*a);
+        CHECK(&y == &*b);
+        CHECK(*a == 10);
+        CHECK(*b == "two!");
+        CHECK(*c == "three!");
+        CHECK(*c2 == "three");
+    }
+}
+
+TEST_CASE("copy_on_write hashing") {
+    SUBCASE("std::hash agrees with the underlying value") {
+        copy_on_write<std::string> a("key");
+        CHECK(std::hash<copy_on_write<std::string>>{}(a) == std::hash<std::string>{}("key"));
+
+        std::unordered_set<copy_on_write<std::string>> set{a, copy_on_write<std::string>("b")};
+        CHECK(set.count(a) == 1);
+        CHECK(set.count(copy_on_write<std::string>("b")) == 1);
+        CHECK(set.count(copy_on_write<std::string>("c")) == 0);
+    }
+
+    SUBCASE("std::hash is disabled for unhashable values") {
+        CHECK_FALSE(std::is_default_constructible_v<std::hash<copy_on_write<unhashable>>>);
+        CHECK(std::is_default_constructible_v<std::hash<copy_on_write<int>>>);
+    }
+
+    using policy = stlab::hashing::cached<>;
+    using cow = copy_on_write<counted_key, policy>;
+    const std::hash<cow> hash{};
+
+    SUBCASE("the hash is computed once per shared value") {
+        counted_key::hashes = 0;
+        cow a(counted_key{1});
+        cow b = a;
+        const std::size_t h = hash(a);
+        CHECK(h == std::hash<int>{}(1));
+        CHECK(hash(b) == h);
+        CHECK(hash(a) == h);
+        CHECK(counted_key::hashes == 1);
+    }
+
+    SUBCASE("write invalidates the cached hash") {
+        cow a(counted_key{1});
+        (void)hash(a);
+        a.write()._value = 2;
+        CHECK(hash(a) == std::hash<int>{}(2));
+
+        a.write([](const counted_key& x) { return counted_key{x._value + 1}; },
+                [](counted_key& x) { x._value += 1; });
+        CHECK(hash(a) == std::hash<int>{}(3));
+    }
+
+    SUBCASE("a detached copy does not disturb the shared hash") {
+        cow a(counted_key{1});
+        cow b = a;
+        (void)hash(a);
+        b.write()._value = 5;
+        counted_key::hashes = 0;
+        CHECK(hash(a) == std::hash<int>{}(1));
+        CHECK(counted_key::hashes == 0);
+        CHECK(hash(b) == std::hash<int>{}(5));
+    }
+
+    SUBCASE("in-place assignment invalidates the cached hash") {
+        cow a(counted_key{1});
+        (void)hash(a);
+        a = counted_key{7};
+        CHECK(hash(a) == std::hash<int>{}(7));
+    }
+}
+
+TEST_CASE("copy_on_write external storage") {
+    using policy = stlab::storage::external<>;
+    using cow = copy_on_write<std::vector<int>, policy>;
+
+    const std::vector<int> buffer{1, 2, 3};
+    int releases = 0;
+    auto release = [&releases]() noexcept { ++releases; };
+
+    SUBCASE("reads do not copy and release happens once") {
+        {
+            cow a(stlab::external, buffer, release);
+            cow b = a;
+            CHECK(&*a == &buffer);
+            CHECK(&b.read() == &buffer);
+            CHECK(a.identity(b));
+            CHECK(a == buffer);
+        }
+        CHECK(releases == 1);
+    }
+
+    SUBCASE("the first write copies even when unique") {
+        cow a(stlab::external, buffer, release);
+        CHECK(a.unique());
+        a.write().push_back(4);
+        CHECK(releases == 1);
+        CHECK(buffer == std::vector<int>{1, 2, 3});
+        CHECK(*a == std::vector<int>{1, 2, 3, 4});
+
+        const auto* owned = &*a;
+        a.write().push_back(5);
+        CHECK(&*a == owned);
+    }
+
+    SUBCASE("assignment and take do not modify the external value") {
+        cow a(stlab::external, buffer, release);
+        a = std::vector<int>{7};
+        CHECK(*a == std::vector<int>{7});
+        CHECK(buffer.size() == 3);
+
+        cow b(stlab::external, buffer, release);
+        std::vector<int> taken = std::move(b).take();
+        CHECK(taken == buffer);
+        CHECK(buffer.size() == 3);
+        CHECK(releases == 2);
+    }
+
+    SUBCASE("owned values behave as usual") {
+        cow a;
+        CHECK(a->empty());
+        cow b(std::vector<int>{1});
+        const auto* p = &*b;
+        b.write().push_back(2);
+        CHECK(&*b == p);
+
+        allocation_counts counts;
+        auto c = stlab::allocate_copy_on_write<std::vector<int>, policy>(
+            counting_allocator<int>(counts), 3, 0);
+        CHECK(c->size() == 3);
+        CHECK(counts.allocations == 1);
+    }
+}
+
+TEST_CASE("copy_on_write derived values") {
+    using policy = stlab::caching::derived<>;
+    using cow = copy_on_write<std::vector<int>, policy>;
+    struct sum_tag;
+    struct size_tag;
+
+    int computations = 0;
+    auto sum = [&computations](const std::vector<int>& v) {
+        ++computations;
+        int total = 0;
+        for (int x : v)
+            total += x;
+        return total;
+    };
+
+    SUBCASE("a derived value is computed once per shared value") {
+        cow a(std::vector<int>{1, 2, 3});
+        cow b = a;
+        CHECK(a.derived<sum_tag>(sum) == 6);
+        CHECK(b.derived<sum_tag>(sum) == 6);
+        CHECK(&a.derived<sum_tag>(sum) == &b.derived<sum_tag>(sum));
+        CHECK(computations == 1);
+    }
+
+    SUBCASE("tags are cached separately") {
+        cow a(std::vector<int>{1, 2, 3});
+        CHECK(a.derived<sum_tag>(sum) == 6);
+        CHECK(a.derived<size_tag>([](const std::vector<int>& v) { return v.size(); }) == 3);
+        CHECK(a.derived<sum_tag>(sum) == 6);
+        CHECK(computations == 1);
+    }
+
+    SUBCASE("in-place writes reset the cache") {
+        cow a(std::vector<int>{1, 2, 3});
+        (void)a.derived<sum_tag>(sum);
+        a.write().push_back(4);
+        CHECK(a.derived<sum_tag>(sum) == 10);
+
+        a.write([](const std::vector<int>& v) { return v; },
+                [](std::vector<int>& v) { v.push_back(5); });
+        CHECK(a.derived<sum_tag>(sum) == 15);
+
+        a = std::vector<int>{7};
+        CHECK(a.derived<sum_tag>(sum) == 7);
+        CHECK(computations == 4);
+    }
+
+    SUBCASE("a detached copy starts with an empty cache") {
+        cow a(std::vector<int>{1, 2, 3});
+        cow b = a;
+        (void)a.derived<sum_tag>(sum);
+        b.write().push_back(4);
+        CHECK(b.derived<sum_tag>(sum) == 10);
+        CHECK(a.derived<sum_tag>(sum) == 6);
+        CHECK(computations == 2);
+    }
+
+    SUBCASE("a throwing computation is retried") {
+        cow a(std::vector<int>{1});
+        bool fail = true;
+        auto flaky = [&fail](const std::vector<int>& v) {
+            if (fail) throw std::runtime_error("flaky");
+            return v.size();
+        };
+        CHECK_THROWS_AS((void)a.derived<size_tag>(flaky), std::runtime_error);
+        fail = false;
+        CHECK(a.derived<size_tag>(flaky) == 1);
+    }
+
+    SUBCASE("threads sharing a value compute it once") {
+        cow a(std::vector<int>(1000, 1));
+        std::atomic<int> shared_computations{0};
+        std::atomic<int> mismatches{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t != 16; ++t) {
+            threads.emplace_back([a, &shared_computations, &mismatches] {
+                const int total = a.derived<sum_tag>([&](const std::vector<int>& v) {
+                    ++shared_computations;
+                    int n = 0;
+                    for (int x : v)
+                        n += x;
+                    return n;
+                });
+                if (total != 1000) ++mismatches;
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        CHECK(shared_computations == 1);
+        CHECK(mismatches == 0);
+    }
+}
+
+TEST_CASE("copy_on_write dirty range tracking") {
+    using policy = stlab::tracking::dirty_ranges<>;
+    using cow = copy_on_write<std::vector<int>, policy>;
+    using ranges = std::vector<std::pair<std::size_t, std::size_t>>;
+
+    const cow a(std::vector<int>(100, 0));
+
+    SUBCASE("a copy made by write_range knows its changes") {
+        cow b = a;
+        int* p = b.write_range(10, 12);
+        p[0] = 1;
+        p[1] = 2;
+        CHECK((*b)[10] == 1);
+        CHECK((*a)[10] == 0);
+        CHECK(b.delta(a) == ranges{{10, 12}});
+
+        b.write_range(50, 51)[0] = 3;
+        b.write_range(11, 20)[0] = 4;
+        b.write_range(20, 25)[0] = 5;
+        CHECK(b.delta(a) == ranges{{10, 25}, {50, 51}});
+        CHECK(b.delta(b) == ranges{});
+    }
+
+    SUBCASE("unrelated values have no known delta") {
+        cow b(std::vector<int>(100, 0));
+        CHECK_FALSE(b.delta(a));
+        b.write_range(0, 1)[0] = 1;
+        CHECK_FALSE(b.delta(a));
+        CHECK(b.write_range(1, 2) == b.write().data() + 1);
+    }
+
+    SUBCASE("other writes make the delta unknown") {
+        cow b = a;
+        b.write_range(0, 1)[0] = 1;
+        b.write()[2] = 2;
+        CHECK_FALSE(b.delta(a));
+
+        cow c = a;
+        c.write_range(0, 1)[0] = 1;
+        c = std::vector<int>(100, 1);
+        CHECK_FALSE(c.delta(a));
+    }
+
+    SUBCASE("modifying the original makes the delta unknown") {
+        cow original(std::vector<int>(10, 0));
+        cow b = original;
+        b.write_range(0, 1)[0] = 1;
+        REQUIRE(b.delta(original));
+
+        original.write_range(5, 6)[0] = 1;
+        CHECK_FALSE(b.delta(original));
+    }
+
+    SUBCASE("deltas are between directly related values") {
+        cow b = a;
+        b.write_range(0, 1)[0] = 1;
+        cow c = b;
+        c.write_range(5, 6)[0] = 1;
+        CHECK(c.delta(b) == ranges{{5, 6}});
+        CHECK_FALSE(c.delta(a));
+    }
+}
+
+TEST_CASE("copy_on_write version tokens") {
+    using policy = stlab::tracking::versioned<>;
+    using cow = copy_on_write<std::vector<int>, policy>;
+
+    SUBCASE("copies share a version") {
+        cow a(std::vector<int>{1, 2, 3});
+        cow b = a;
+        CHECK(a.version() == b.version());
+        CHECK(a.version().identity == a.identity());
+        CHECK(a.version() != stlab::version_token{});
+    }
+
+    SUBCASE("in place modifications renew the version") {
+        cow a(std::vector<int>{1, 2, 3});
+        REQUIRE(a.unique());
+        const void* id = a.identity();
+
+        auto v = a.version();
+        a.write()[0] = 4;
+        CHECK(a.identity() == id);
+        CHECK(a.version() != v);
+
+        v = a.version();
+        a.write([](const std::vector<int>& x) { return x; }, [](std::vector<int>& x) { x[1] = 5; });
+        CHECK(a.identity() == id);
+        CHECK(a.version() != v);
+
+        v = a.version();
+        a = std::vector<int>{7};
+        CHECK(a.identity() == id);
+        CHECK(a.version() != v);
+    }
+
+    SUBCASE("reading does not renew the version") {
+        cow a(std::vector<int>{1, 2, 3});
+        auto v = a.version();
+        CHECK(a.read().size() == 3);
+        CHECK(a.version() == v);
+    }
+
+    SUBCASE("a detaching write gives a new version") {
+        cow a(std::vector<int>{1, 2, 3});
+        cow b = a;
+        auto v = a.version();
+        b.write()[0] = 4;
+        CHECK(a.version() == v);
+        CHECK(b.version() != v);
+    }
+
+    SUBCASE("versions combine with range tracking") {
+        using tracked = copy_on_write<std::vector<int>,
+                                      stlab::tracking::versioned<stlab::tracking::dirty_ranges<>>>;
+        tracked a(std::vector<int>(10, 0));
+        auto v = a.version();
+        a.write_range(0, 1)[0] = 1;
+        CHECK(a.version() != v);
+    }
+}
+
+TEST_CASE("copy_on_write bulk sharing") {
+    using cow = copy_on_write<std::string>;
+
+    SUBCASE("share_n writes copies sharing the value") {
+        cow a("snapshot");
+        std::vector<cow> copies;
+        auto out = a.share_n(std::back_inserter(copies), 5);
+        *out = a;
+        REQUIRE(copies.size() == 6);
+        for (const auto& c : copies)
+            CHECK(c.identity(a));
+
+        cow::release_range(copies.begin(), copies.end());
+        CHECK(a.unique());
+        copies.clear();
+        CHECK(a.unique());
+        CHECK(*a == "snapshot");
+    }
+
+    SUBCASE("release_range destroys values shared only by the range") {
+        std::vector<cow> copies;
+        cow("temporary").share_n(std::back_inserter(copies), 3);
+        cow other("other");
+        copies.push_back(other);
+        copies.push_back(cow());
+        cow::release_range(copies.begin(), copies.end());
+        CHECK(other.unique());
+    }
+
+    SUBCASE("share_n of a default constructed value") {
+        cow a;
+        std::vector<cow> copies(3);
+        CHECK(a.share_n(copies.begin(), 3) == copies.end());
+        CHECK(copies[2].identity(a));
+    }
+
+    SUBCASE("share_n releases the unused references if the output throws") {
+        struct throwing_output {
+            std::vector<cow>* _out;
+            auto operator*() -> throwing_output& { return *this; }
+            auto operator++() -> throwing_output& { return *this; }
+            auto operator=(cow x) -> throwing_output& {
+                if (_out->size() == 2) throw std::runtime_error("full");
+                _out->push_back(std::move(x));
+                return *this;
+            }
+        };
+
+        cow a("shared");
+        std::vector<cow> copies;
+        CHECK_THROWS_AS(a.share_n(throwing_output{&copies}, 5), std::runtime_error);
+        CHECK(copies.size() == 2);
+        copies.clear();
+        CHECK(a.unique());
+    }
+
+    SUBCASE("share_n copies values stored inline") {
+        copy_on_write<int, stlab::storage::always_inline<>> a(7);
+        std::vector<copy_on_write<int, stlab::storage::always_inline<>>> copies;
+        a.share_n(std::back_inserter(copies), 2);
+        CHECK(copies.size() == 2);
+        CHECK(*copies[1] == 7);
+    }
+}
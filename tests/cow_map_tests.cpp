@@ -0,0 +1,244 @@
+#include <stlab/cow_map.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+using stlab::cow_map;
+
+namespace {
+
+// The number of allocations which succeed before one throws, or -1 for no limit.
+int allocations_left = -1;
+
+} // namespace
+
+auto operator new(std::size_t n) -> void* {
+    if (allocations_left == 0) throw std::bad_alloc();
+    if (allocations_left > 0) --allocations_left;
+    if (void* p = std::malloc(n != 0 ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// GCC cannot tell that these are the replacements matching operator new above.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+// Hashes every key to the same value so all entries land in one collision node.
+struct constant_hash {
+    auto operator()(int) const noexcept -> std::size_t { return 42; }
+};
+
+// Keeps only the high bits so keys share long prefixes of the trie.
+struct high_bits_hash {
+    auto operator()(int x) const noexcept -> std::size_t {
+        return static_cast<std::size_t>(x) << (sizeof(std::size_t) * 8 - 8);
+    }
+};
+
+template <class Map>
+auto to_map(const Map& m) -> std::map<typename Map::key_type, typename Map::mapped_type> {
+    return {m.begin(), m.end()};
+}
+
+} // namespace
+
+TEST_CASE("cow_map construction and lookup") {
+    SUBCASE("default construction") {
+        cow_map<int, int> m;
+        CHECK(m.empty());
+        CHECK(m.size() == 0);
+        CHECK(m.begin() == m.end());
+        CHECK(m.find(1) == m.end());
+        CHECK_FALSE(m.contains(1));
+    }
+
+    SUBCASE("initializer list construction ignores later duplicates") {
+        cow_map<std::string, int> m{{"one", 1}, {"two", 2}, {"one", 3}};
+        CHECK(m.size() == 2);
+        CHECK(m.at("one") == 1);
+        CHECK(m.at("two") == 2);
+        CHECK(m.count("two") == 1);
+        CHECK(m.count("three") == 0);
+        CHECK_THROWS_AS(m.at("three"), std::out_of_range);
+    }
+
+    SUBCASE("find returns an iterator to the entry") {
+        cow_map<int, int> m;
+        for (int i = 0; i != 1000; ++i)
+            m.insert(i, i * i);
+        auto p = m.find(31);
+        REQUIRE(p != m.end());
+        CHECK(p->first == 31);
+        CHECK(p->second == 961);
+    }
+}
+
+TEST_CASE("cow_map modification") {
+    SUBCASE("insert, insert_or_assign and erase") {
+        cow_map<int, std::string> m;
+        CHECK(m.insert(1, "a"));
+        CHECK_FALSE(m.insert(1, "b"));
+        CHECK(m.at(1) == "a");
+        CHECK_FALSE(m.insert_or_assign(1, "c"));
+        CHECK(m.at(1) == "c");
+        CHECK(m.insert_or_assign(2, "d"));
+        CHECK(m.size() == 2);
+        CHECK(m.erase(1) == 1);
+        CHECK(m.erase(1) == 0);
+        CHECK(m.size() == 1);
+        CHECK_FALSE(m.contains(1));
+        m.clear();
+        CHECK(m.empty());
+    }
+
+    SUBCASE("many entries match std::map") {
+        cow_map<int, int> m;
+        std::map<int, int> expected;
+        for (int i = 0; i != 5000; ++i) {
+            m.insert(i * 7919 % 10007, i);
+            expected.emplace(i * 7919 % 10007, i);
+        }
+        for (int i = 0; i < 10007; i += 3) {
+            CHECK(m.erase(i) == expected.erase(i));
+        }
+        CHECK(m.size() == expected.size());
+        CHECK(to_map(m) == expected);
+        std::size_t n = 0;
+        for (auto p = m.begin(); p != m.end(); ++p)
+            ++n;
+        CHECK(n == m.size());
+        for (const auto& e : expected)
+            CHECK(m.find(e.first)->second == e.second);
+    }
+
+    SUBCASE("full hash collisions") {
+        cow_map<int, int, constant_hash> m;
+        for (int i = 0; i != 20; ++i)
+            CHECK(m.insert(i, i));
+        CHECK(m.size() == 20);
+        CHECK(m.at(13) == 13);
+        CHECK(m.find(7)->second == 7);
+        for (int i = 0; i != 20; i += 2)
+            CHECK(m.erase(i) == 1);
+        CHECK(m.size() == 10);
+        CHECK_FALSE(m.contains(4));
+        CHECK(m.at(5) == 5);
+
+        cow_map<int, int, constant_hash> reversed;
+        for (int i = 19; i >= 0; i -= 2)
+            reversed.insert(i, i);
+        CHECK(m == reversed);
+    }
+
+    SUBCASE("shared hash prefixes") {
+        cow_map<int, int, high_bits_hash> m;
+        for (int i = 0; i != 256; ++i)
+            m.insert(i, -i);
+        for (int i = 0; i != 256; ++i)
+            CHECK(m.at(i) == -i);
+        for (int i = 0; i != 255; ++i)
+            m.erase(i);
+        CHECK(m.size() == 1);
+        CHECK(to_map(m) == std::map<int, int>{{255, -255}});
+    }
+}
+
+TEST_CASE("cow_map sharing") {
+    cow_map<int, int> a;
+    for (int i = 0; i != 10000; ++i)
+        a.insert(i, i);
+
+    SUBCASE("copies share until modified") {
+        cow_map<int, int> b = a;
+        CHECK(b.identity(a));
+        CHECK(b == a);
+
+        b.insert_or_assign(17, -17);
+        CHECK_FALSE(b.identity(a));
+        CHECK(a.at(17) == 17);
+        CHECK(b.at(17) == -17);
+        CHECK(b != a);
+
+        b.insert_or_assign(17, 17);
+        CHECK(b == a);
+    }
+
+    SUBCASE("entries off the modified path keep their address") {
+        cow_map<int, int> b = a;
+        const int* untouched = &a.find(5000)->second;
+        const int* touched = &a.find(42)->second;
+
+        b.erase(42);
+        CHECK(a.contains(42));
+        CHECK_FALSE(b.contains(42));
+        CHECK(&b.find(5000)->second == untouched);
+        CHECK(&a.find(42)->second == touched);
+        CHECK(b.size() + 1 == a.size());
+    }
+
+    SUBCASE("erasing an absent key does not detach") {
+        cow_map<int, int> b = a;
+        CHECK(b.erase(20000) == 0);
+        CHECK(b.identity(a));
+    }
+
+    SUBCASE("inserting a present key does not detach") {
+        cow_map<int, int> b = a;
+        CHECK_FALSE(b.insert(5, 99));
+        CHECK(b.identity(a));
+        CHECK(b.at(5) == 5);
+    }
+
+    SUBCASE("maps built in different orders compare equal") {
+        cow_map<int, int> c;
+        for (int i = 9999; i >= 0; --i)
+            c.insert(i, i);
+        CHECK(c == a);
+        c.erase(0);
+        CHECK(c != a);
+    }
+}
+
+TEST_CASE("cow_map insert leaves the map unchanged if an allocation fails") {
+    cow_map<int, int> m;
+    for (int i = 0; i != 64; ++i)
+        m.insert(i, i);
+    auto expected = to_map(m);
+
+    // Each key shares the first two levels of the trie with an existing entry, which moves into a
+    // new child node.
+    for (int key = 1024; key != 1088; ++key) {
+        const cow_map<int, int> shared = key % 2 ? m : cow_map<int, int>();
+        for (int limit = 0;; ++limit) {
+            bool threw = false;
+            allocations_left = limit;
+            try {
+                m.insert(key, key);
+            } catch (const std::bad_alloc&) {
+                threw = true;
+            }
+            allocations_left = -1;
+            if (!threw) break;
+            REQUIRE(m.size() == expected.size());
+            REQUIRE(to_map(m) == expected);
+        }
+        expected.emplace(key, key);
+        REQUIRE(to_map(m) == expected);
+    }
+}
@@ -0,0 +1,149 @@
+#include <stlab/cow_vector.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using stlab::cow_vector;
+
+namespace {
+
+// Counts copy and move constructions.
+struct counted {
+    static inline int constructions = 0;
+    int _value{0};
+
+    explicit counted(int x) : _value(x) {}
+    counted(const counted& x) : _value(x._value) { ++constructions; }
+    counted(counted&& x) noexcept : _value(x._value) { ++constructions; }
+    auto operator=(const counted&) -> counted& = default;
+    auto operator=(counted&&) noexcept -> counted& = default;
+    ~counted() = default;
+};
+
+} // namespace
+
+TEST_CASE("cow_vector construction and access") {
+    SUBCASE("default construction") {
+        cow_vector<int> v;
+        CHECK(v.empty());
+        CHECK(v.size() == 0);
+        CHECK(v.begin() == v.end());
+    }
+
+    SUBCASE("fill construction spans several chunks") {
+        cow_vector<int, 4> v(10, 7);
+        CHECK(v.size() == 10);
+        CHECK(v[0] == 7);
+        CHECK(v[9] == 7);
+        CHECK(v.front() == 7);
+        CHECK(v.back() == 7);
+    }
+
+    SUBCASE("range construction and iteration") {
+        std::vector<int> source(25);
+        std::iota(source.begin(), source.end(), 0);
+        cow_vector<int, 4> v(source.begin(), source.end());
+
+        CHECK(std::vector<int>(v.begin(), v.end()) == source);
+        CHECK(v.end() - v.begin() == 25);
+        CHECK(v.begin()[13] == 13);
+        CHECK(std::accumulate(v.begin(), v.end(), 0) == 300);
+    }
+
+    SUBCASE("at throws out of range") {
+        cow_vector<int> v{1, 2, 3};
+        CHECK(v.at(2) == 3);
+        CHECK_THROWS_AS(v.at(3), std::out_of_range);
+    }
+}
+
+TEST_CASE("cow_vector modification") {
+    cow_vector<std::string, 4> v;
+    for (int i = 0; i != 9; ++i)
+        v.push_back(std::to_string(i));
+
+    SUBCASE("write and set") {
+        v.write(5) = "five";
+        v.set(8, "eight");
+        CHECK(v[5] == "five");
+        CHECK(v[8] == "eight");
+        CHECK(v[4] == "4");
+    }
+
+    SUBCASE("pop_back across chunk boundaries") {
+        v.pop_back();
+        CHECK(v.size() == 8);
+        CHECK(v.back() == "7");
+        v.pop_back();
+        v.push_back("x");
+        CHECK(v.size() == 8);
+        CHECK(v.back() == "x");
+    }
+
+    SUBCASE("resize and clear") {
+        v.resize(3);
+        CHECK(v.size() == 3);
+        CHECK(v.back() == "2");
+        v.resize(6, "y");
+        CHECK(v.size() == 6);
+        CHECK(v[5] == "y");
+        v.clear();
+        CHECK(v.empty());
+    }
+}
+
+TEST_CASE("cow_vector sharing") {
+    cow_vector<int, 4> v1;
+    for (int i = 0; i != 12; ++i)
+        v1.push_back(i);
+
+    cow_vector<int, 4> v2(v1);
+    CHECK(v1.identity(v2));
+    CHECK(v1 == v2);
+
+    const int* first_chunk = &v1[0];
+    const int* last_chunk = &v1[8];
+
+    v2.write(9) = 90;
+
+    CHECK_FALSE(v1.identity(v2));
+    CHECK(v1[9] == 9);
+    CHECK(v2[9] == 90);
+    CHECK(&v2[0] == first_chunk); // untouched chunks are still shared
+    CHECK(&v2[8] != last_chunk);  // only the modified chunk was copied
+    CHECK(&v1[8] == last_chunk);
+
+    CHECK(v1 != v2);
+    CHECK(v1 < v2);
+    CHECK(v2 > v1);
+
+    v2.set(9, 9);
+    CHECK(v1 == v2);
+
+    swap(v1, v2);
+    CHECK(v1 == v2);
+}
+
+TEST_CASE("cow_vector push_back onto a shared chunk copies it once") {
+    cow_vector<counted, 8> v1;
+    for (int i = 0; i != 5; ++i)
+        v1.emplace_back(i);
+    cow_vector<counted, 8> v2(v1);
+
+    counted::constructions = 0;
+    v2.emplace_back(5);
+    CHECK(counted::constructions == 5);
+    const counted* first = &v2[0];
+    v2.emplace_back(6);
+    v2.emplace_back(7);
+    CHECK(&v2[0] == first);
+    CHECK(counted::constructions == 5);
+    CHECK(v1.size() == 5);
+    CHECK(v2[7]._value == 7);
+}
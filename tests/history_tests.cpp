@@ -0,0 +1,221 @@
+#include <stlab/history.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using stlab::copy_on_write;
+using stlab::history;
+
+namespace {
+
+using document = std::vector<char>;
+
+auto make_document(std::size_t n, char c) -> copy_on_write<document> {
+    document d;
+    d.reserve(n);
+    d.assign(n, c);
+    return copy_on_write<document>(std::move(d));
+}
+
+// Measures a string by its length, throwing while `fail` is set.
+struct throwing_size_of {
+    static inline bool fail = false;
+
+    auto operator()(const std::string& x) const -> std::size_t {
+        if (fail) throw std::runtime_error("size_of failed");
+        return x.size();
+    }
+};
+
+} // namespace
+
+TEST_CASE("default_size_of") {
+    std::vector<int> v;
+    v.reserve(10);
+    CHECK(stlab::default_size_of<std::vector<int>>()(v) ==
+          sizeof(std::vector<int>) + v.capacity() * sizeof(int));
+    CHECK(stlab::default_size_of<int>()(5) == sizeof(int));
+}
+
+TEST_CASE("history undo and redo") {
+    history<std::string> h(copy_on_write<std::string>("a"));
+    CHECK(h.size() == 1);
+    CHECK_FALSE(h.can_undo());
+    CHECK_FALSE(h.can_redo());
+    CHECK_FALSE(h.undo());
+
+    CHECK(h.commit(copy_on_write<std::string>("b")));
+    CHECK(h.commit(copy_on_write<std::string>("c")));
+    CHECK(h.size() == 3);
+    CHECK(*h.current() == "c");
+
+    CHECK(h.undo());
+    CHECK(*h.current() == "b");
+    CHECK(h.undo());
+    CHECK(*h.current() == "a");
+    CHECK_FALSE(h.undo());
+    CHECK(h.redo_count() == 2);
+
+    CHECK(h.redo());
+    CHECK(*h.current() == "b");
+
+    SUBCASE("commit discards redo states") {
+        CHECK(h.commit(copy_on_write<std::string>("d")));
+        CHECK(h.size() == 3);
+        CHECK_FALSE(h.can_redo());
+        CHECK(h.undo());
+        CHECK(*h.current() == "b");
+    }
+
+    SUBCASE("clear keeps only the current state") {
+        h.clear();
+        CHECK(h.size() == 1);
+        CHECK(*h.current() == "b");
+    }
+}
+
+TEST_CASE("history commit failure") {
+    using throwing_history = history<std::string, stlab::threading::multi, throwing_size_of>;
+    throwing_history h(copy_on_write<std::string>("a"));
+    h.commit(copy_on_write<std::string>("bb"));
+    h.commit(copy_on_write<std::string>("ccc"));
+
+    SUBCASE("a failed commit keeps the redo states") {
+        h.undo();
+        h.undo();
+        throwing_size_of::fail = true;
+        CHECK_THROWS_AS(h.commit(copy_on_write<std::string>("dddd")), std::runtime_error);
+        throwing_size_of::fail = false;
+
+        CHECK(*h.current() == "a");
+        CHECK(h.redo_count() == 2);
+        CHECK(h.resident_bytes() == 6);
+        CHECK(h.redo());
+        CHECK(*h.current() == "bb");
+    }
+
+    SUBCASE("a failed commit without redo states changes nothing") {
+        throwing_size_of::fail = true;
+        CHECK_THROWS_AS(h.commit(copy_on_write<std::string>("dddd")), std::runtime_error);
+        throwing_size_of::fail = false;
+
+        CHECK(*h.current() == "ccc");
+        CHECK(h.size() == 3);
+        CHECK(h.resident_bytes() == 6);
+    }
+
+    SUBCASE("a commit replaces the redo states") {
+        h.undo();
+        h.undo();
+        CHECK(h.commit(copy_on_write<std::string>("dddd")));
+        CHECK(h.size() == 2);
+        CHECK(h.resident_bytes() == 5);
+        CHECK(h.logical_bytes() == 5);
+    }
+}
+
+TEST_CASE("history coalescing") {
+    copy_on_write<std::string> doc("text");
+    history<std::string> h(doc);
+
+    CHECK_FALSE(h.commit(doc));
+    CHECK(h.size() == 1);
+
+    doc.write() += "!";
+    CHECK(h.commit(doc));
+    CHECK_FALSE(h.commit(doc));
+    CHECK(h.size() == 2);
+    CHECK(*h.current() == "text!");
+}
+
+TEST_CASE("history memory accounting") {
+    constexpr std::size_t n = 1000;
+    const std::size_t bytes = sizeof(document) + n;
+
+    auto a = make_document(n, 'a');
+    auto b = make_document(n, 'b');
+    history<document> h(a);
+    CHECK(h.resident_bytes() == bytes);
+
+    SUBCASE("shared values are counted once") {
+        h.commit(b);
+        h.commit(a); // not coalesced, since it differs from the current state
+        CHECK(h.size() == 3);
+        CHECK(h.logical_bytes() == 3 * bytes);
+        CHECK(h.resident_bytes() == 2 * bytes);
+
+        h.undo();
+        h.undo();
+        h.commit(make_document(n, 'c')); // discards both redo states
+        CHECK(h.size() == 2);
+        CHECK(h.resident_bytes() == 2 * bytes);
+        CHECK(h.logical_bytes() == 2 * bytes);
+    }
+
+    SUBCASE("the oldest states are evicted over budget") {
+        h.set_budget(3 * bytes);
+        h.commit(b);
+        h.commit(make_document(n, 'c'));
+        CHECK(h.size() == 3);
+        h.commit(make_document(n, 'd'));
+        CHECK(h.size() == 3);
+        CHECK(h.resident_bytes() == 3 * bytes);
+
+        h.undo();
+        h.undo();
+        CHECK_FALSE(h.can_undo());
+        CHECK(h.current() == b);
+    }
+
+    SUBCASE("redo states are evicted when there is nothing older") {
+        h.commit(b);
+        h.undo();
+        h.set_budget(bytes);
+        CHECK(h.size() == 1);
+        CHECK(h.current().identity(a));
+    }
+
+    SUBCASE("copies rebuild the accounting") {
+        h.commit(b);
+        history<document> c = h;
+        CHECK(c.resident_bytes() == h.resident_bytes());
+        c.undo();
+        c.clear();
+        CHECK(c.resident_bytes() == bytes);
+        CHECK(h.resident_bytes() == 2 * bytes);
+    }
+}
+
+TEST_CASE("history with inline storage") {
+    using policy = stlab::storage::always_inline<>;
+    history<int, policy> h(copy_on_write<int, policy>(1));
+    h.commit(copy_on_write<int, policy>(2));
+    h.commit(copy_on_write<int, policy>(3));
+    CHECK(h.resident_bytes() == 3 * sizeof(int));
+
+    history<int, policy> c = h;
+    c.undo();
+    CHECK(*c.current() == 2);
+    c.clear();
+    CHECK(c.resident_bytes() == sizeof(int));
+
+    // Committing over redo states reuses their slots.
+    h.undo();
+    h.undo();
+    h.commit(copy_on_write<int, policy>(4));
+    CHECK(h.size() == 2);
+    CHECK(*h.current() == 4);
+    CHECK(h.resident_bytes() == 2 * sizeof(int));
+    h.commit(copy_on_write<int, policy>(3));
+    h.undo();
+    h.undo();
+    h.redo();
+    h.redo();
+    CHECK(*h.current() == 3);
+    CHECK(h.resident_bytes() == 3 * sizeof(int));
+}
@@ -0,0 +1,98 @@
+#include <stlab/intern_pool.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+using stlab::copy_on_write;
+using stlab::intern_pool;
+
+TEST_CASE("intern_pool merges equal values") {
+    intern_pool<std::string> pool;
+
+    copy_on_write<std::string> a("shared text");
+    copy_on_write<std::string> b("shared text");
+    copy_on_write<std::string> c("other text");
+    CHECK_FALSE(a.identity(b));
+
+    auto ia = pool.intern(a);
+    auto ib = pool.intern(b);
+    auto ic = pool.intern(c);
+
+    CHECK(ia.identity(a));
+    CHECK(ib.identity(a));
+    CHECK_FALSE(ic.identity(a));
+    CHECK(*ib == "shared text");
+    CHECK(pool.size() == 2);
+}
+
+TEST_CASE("intern_pool reclaims unused values") {
+    intern_pool<std::string> pool;
+
+    SUBCASE("collect removes values only the pool references") {
+        auto kept = pool.intern(copy_on_write<std::string>("kept"));
+        (void)pool.intern(copy_on_write<std::string>("dropped"));
+        CHECK(pool.size() == 2);
+
+        CHECK(pool.collect() == 1);
+        CHECK(pool.size() == 1);
+        CHECK(pool.intern(copy_on_write<std::string>("kept")).identity(kept));
+    }
+
+    SUBCASE("interning collects as the pool grows") {
+        for (int i = 0; i != 10000; ++i)
+            (void)pool.intern(copy_on_write<std::string>(std::to_string(i)));
+        CHECK(pool.size() < 200);
+    }
+
+    SUBCASE("clear") {
+        auto kept = pool.intern(copy_on_write<std::string>("kept"));
+        pool.clear();
+        CHECK(pool.size() == 0);
+        CHECK(*kept == "kept");
+    }
+}
+
+TEST_CASE("intern_pool with a cached hash and custom hash") {
+    using policy = stlab::hashing::cached<>;
+    intern_pool<std::string, policy> cached;
+    copy_on_write<std::string, policy> a("x");
+    CHECK(cached.intern(copy_on_write<std::string, policy>("x")).identity(cached.intern(a)));
+
+    struct length_hash {
+        auto operator()(const std::string& x) const noexcept -> std::size_t { return x.size(); }
+    };
+    intern_pool<std::string, stlab::threading::multi, length_hash> custom;
+    auto p = custom.intern(copy_on_write<std::string>("ab"));
+    auto q = custom.intern(copy_on_write<std::string>("cd"));
+    CHECK_FALSE(p.identity(q));
+    CHECK(custom.intern(copy_on_write<std::string>("cd")).identity(q));
+}
+
+TEST_CASE("intern_pool concurrent interning") {
+    intern_pool<std::string> pool;
+    constexpr int thread_count = 4;
+    std::vector<std::vector<copy_on_write<std::string>>> results(thread_count);
+    std::vector<std::thread> threads;
+    for (int t = 0; t != thread_count; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i != 1000; ++i)
+                results[t].push_back(
+                    pool.intern(copy_on_write<std::string>(std::to_string(i % 100))));
+        });
+    }
+    for (auto& e : threads)
+        e.join();
+
+    bool shared = true;
+    for (int t = 1; t != thread_count; ++t) {
+        for (int i = 0; i != 1000; ++i)
+            shared = shared && results[t][i].identity(results[0][i]);
+    }
+    CHECK(shared);
+    CHECK(pool.size() == 100);
+}
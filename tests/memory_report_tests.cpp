@@ -0,0 +1,82 @@
+#include <stlab/copy_on_write_intrusive.hpp>
+#include <stlab/memory_report.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using stlab::copy_on_write;
+
+namespace {
+
+using buffer = std::vector<char>;
+
+// Counts each buffer as its element count, so the expected sizes are easy to state.
+struct element_count {
+    auto operator()(const buffer& x) const -> std::size_t { return x.size(); }
+};
+
+struct node : stlab::intrusive_cow_counter<node> {
+    int _value{0};
+};
+
+} // namespace
+
+TEST_CASE("measure_memory counts shared values once") {
+    copy_on_write<buffer> a(buffer(100));
+    copy_on_write<buffer> b(buffer(10));
+
+    std::vector<copy_on_write<buffer>> handles{a, a, a, a, b};
+    handles.emplace_back(buffer(1));
+
+    auto report = stlab::measure_memory(handles.begin(), handles.end(), element_count{});
+    CHECK(report.handles == 6);
+    CHECK(report.unique_models == 3);
+    CHECK(report.logical_bytes == 4 * 100 + 10 + 1);
+    CHECK(report.resident_bytes == 100 + 10 + 1);
+    CHECK(report.sharing == std::vector<std::size_t>{2, 0, 1});
+    CHECK(report.sharing_ratio() == 411.0 / 111.0);
+}
+
+TEST_CASE("measure_memory of nothing") {
+    std::vector<copy_on_write<buffer>> handles;
+    auto report = stlab::measure_memory(handles.begin(), handles.end());
+    CHECK(report.handles == 0);
+    CHECK(report.resident_bytes == 0);
+    CHECK(report.sharing.empty());
+    CHECK(report.sharing_ratio() == 1.0);
+}
+
+TEST_CASE("memory_meter accumulates over several collections") {
+    copy_on_write<std::string> shared(std::string(1000, 'x'));
+    std::vector<copy_on_write<std::string>> first(3, shared);
+    std::vector<copy_on_write<std::string>> second(2, shared);
+    second.emplace_back("other");
+
+    stlab::memory_meter<copy_on_write<std::string>> meter;
+    meter.add(first.begin(), first.end());
+    meter.add(second.begin(), second.end());
+
+    auto report = meter.report();
+    CHECK(report.handles == 6);
+    CHECK(report.unique_models == 2);
+    CHECK(report.resident_bytes == stlab::default_size_of<std::string>{}(*shared) +
+                                       stlab::default_size_of<std::string>{}(second.back()));
+    CHECK(report.sharing == std::vector<std::size_t>{1, 0, 1});
+
+    meter.clear();
+    CHECK(meter.report().handles == 0);
+}
+
+TEST_CASE("memory_meter works with intrusive handles") {
+    stlab::copy_on_write_intrusive<node> a;
+    a.write()._value = 1;
+    std::vector<stlab::copy_on_write_intrusive<node>> handles{a, a};
+    auto report = stlab::measure_memory(handles.begin(), handles.end());
+    CHECK(report.unique_models == 1);
+    CHECK(report.resident_bytes == sizeof(node));
+    CHECK(report.logical_bytes == 2 * sizeof(node));
+}
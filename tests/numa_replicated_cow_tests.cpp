@@ -0,0 +1,103 @@
+#include <stlab/numa_replicated_cow.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+using stlab::copy_on_write;
+using stlab::numa_replicated_cow;
+
+namespace {
+
+// A topology of four nodes, with the node of each thread set by the test.
+struct fake_topology {
+    static inline thread_local std::size_t node = 0;
+
+    static auto node_count() -> std::size_t { return 4; }
+    static auto current_node() noexcept -> std::size_t { return node; }
+};
+
+using replicated = numa_replicated_cow<std::string, stlab::threading::multi, fake_topology>;
+
+} // namespace
+
+TEST_CASE("numa_topology describes the system") {
+    CHECK(stlab::numa_topology::node_count() >= 1);
+    CHECK(stlab::numa_topology::current_node() < stlab::numa_topology::node_count());
+}
+
+TEST_CASE("numa_replicated_cow replicates on read") {
+    copy_on_write<std::string> value("shared value");
+    replicated x(value);
+    CHECK(x.node_count() == 4);
+    CHECK(x.replica_count() == 0);
+
+    fake_topology::node = 1;
+    CHECK(*x == "shared value");
+    auto on_one = x.load();
+    CHECK_FALSE(on_one.identity(value));
+    CHECK(on_one.identity(x.load()));
+    CHECK(&x.read() == &*on_one);
+    CHECK(x.replica_count() == 1);
+
+    fake_topology::node = 2;
+    auto on_two = x.load();
+    CHECK_FALSE(on_two.identity(on_one));
+    CHECK(*on_two == "shared value");
+    CHECK(x.replica_count() == 2);
+    CHECK(x.get().identity(value));
+
+    fake_topology::node = 0;
+}
+
+TEST_CASE("numa_replicated_cow writes produce a new version") {
+    replicated x(copy_on_write<std::string>("first"));
+    fake_topology::node = 3;
+    auto old_replica = x.load();
+
+    x.write() += " changed";
+    CHECK(x.replica_count() == 0);
+    CHECK(*x == "first changed");
+    CHECK(*old_replica == "first");
+
+    x = copy_on_write<std::string>("second");
+    CHECK(x->size() == 6);
+
+    replicated y(x);
+    CHECK(y.get().identity(x.get()));
+    CHECK(*y == "second");
+    fake_topology::node = 0;
+}
+
+TEST_CASE("numa_replicated_cow on a single node reads the value directly") {
+    numa_replicated_cow<std::string> x(copy_on_write<std::string>("only"));
+    if (x.node_count() == 1) {
+        CHECK(x.load().identity(x.get()));
+        CHECK(x.replica_count() == 0);
+    }
+    CHECK(*x == "only");
+}
+
+TEST_CASE("numa_replicated_cow concurrent first reads") {
+    replicated x(copy_on_write<std::string>(std::string(256, 'v')));
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t != 8; ++t) {
+        threads.emplace_back([&x, &mismatches, t] {
+            fake_topology::node = t % 4;
+            for (int i = 0; i != 100; ++i) {
+                auto h = x.load();
+                if (h->size() != 256 || &*h != &x.read()) ++mismatches;
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    CHECK(mismatches == 0);
+    CHECK(x.replica_count() == 4);
+}
@@ -0,0 +1,125 @@
+#include <stlab/parallel_write.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <deque>
+#include <execution>
+#include <list>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+
+using stlab::copy_on_write;
+
+namespace {
+
+struct tracked {
+    static inline int copy_constructions = 0;
+    static inline int copy_assignments = 0;
+    int _value{0};
+
+    tracked() = default;
+    explicit tracked(int v) : _value(v) {}
+    tracked(const tracked& x) : _value(x._value) { ++copy_constructions; }
+    auto operator=(const tracked& x) -> tracked& {
+        _value = x._value;
+        ++copy_assignments;
+        return *this;
+    }
+    ~tracked() = default;
+
+    friend auto operator==(const tracked& x, const tracked& y) -> bool {
+        return x._value == y._value;
+    }
+};
+
+} // namespace
+
+TEST_CASE("write with an execution policy") {
+    SUBCASE("a large shared vector is copied element by element") {
+        std::vector<int> source(1000);
+        std::iota(source.begin(), source.end(), 0);
+        copy_on_write<std::vector<int>> a(source);
+        copy_on_write<std::vector<int>> b = a;
+
+        auto& v = stlab::write(std::execution::seq, b, 0);
+        CHECK_FALSE(a.identity(b));
+        CHECK(v == source);
+        CHECK(&v == &*b);
+        v[0] = -1;
+        CHECK(a->front() == 0);
+    }
+
+    SUBCASE("a unique value is written in place") {
+        copy_on_write<std::vector<int>> a(std::vector<int>(10, 1));
+        const auto* p = &*a;
+        CHECK(&stlab::write(std::execution::seq, a, 0) == p);
+    }
+
+    SUBCASE("a unique value which cannot be written in place is copied element by element") {
+        using external = copy_on_write<std::vector<tracked>, stlab::storage::external<>>;
+        const std::vector<tracked> buffer(100, tracked(3));
+        external a(stlab::external, buffer, [] {});
+        REQUIRE(a.unique());
+
+        tracked::copy_constructions = 0;
+        tracked::copy_assignments = 0;
+        auto& v = stlab::write(std::execution::seq, a, 0);
+        v[0]._value = 4;
+        CHECK(tracked::copy_constructions == 0);
+        CHECK(tracked::copy_assignments == 100);
+        CHECK(buffer[0]._value == 3);
+        CHECK(&v == &*a);
+    }
+
+    SUBCASE("values below the threshold use the plain copy") {
+        copy_on_write<std::vector<int>> a(std::vector<int>(10, 1));
+        copy_on_write<std::vector<int>> b = a;
+        CHECK(stlab::write(std::execution::seq, b) == std::vector<int>(10, 1));
+        CHECK_FALSE(a.identity(b));
+    }
+
+    SUBCASE("other containers and types use the plain copy") {
+        copy_on_write<std::deque<std::string>> d(std::deque<std::string>{"a", "b"});
+        auto d2 = d;
+        CHECK(stlab::write(std::execution::seq, d2, 0) == std::deque<std::string>{"a", "b"});
+        CHECK(stlab::detail::is_parallel_copyable_v<std::deque<std::string>>);
+
+        copy_on_write<std::list<int>> l(std::list<int>{1, 2});
+        auto l2 = l;
+        CHECK(stlab::write(std::execution::seq, l2, 0) == std::list<int>{1, 2});
+        CHECK_FALSE(stlab::detail::is_parallel_copyable_v<std::list<int>>);
+
+        copy_on_write<std::vector<bool>> bits(std::vector<bool>(100, true));
+        auto bits2 = bits;
+        stlab::write(std::execution::seq, bits2, 0)[3] = false;
+        CHECK(bits->at(3));
+        CHECK_FALSE(stlab::detail::is_parallel_copyable_v<std::vector<bool>>);
+
+        copy_on_write<int> i(5);
+        auto i2 = i;
+        stlab::write(std::execution::seq, i2, 0) = 6;
+        CHECK(*i == 5);
+        CHECK_FALSE(stlab::detail::is_parallel_copyable_v<int>);
+    }
+}
+
+#if __has_include(<memory_resource>)
+TEST_CASE("write with an execution policy keeps the allocator") {
+    std::pmr::monotonic_buffer_resource resource;
+    using vector = std::pmr::vector<int>;
+    copy_on_write<vector> a(vector(1000, 7, &resource));
+    copy_on_write<vector> b = a;
+
+    auto& v = stlab::write(std::execution::seq, b, 0);
+    CHECK_FALSE(a.identity(b));
+    CHECK(v == *a);
+    CHECK(v.get_allocator().resource() == &resource);
+}
+#endif
@@ -0,0 +1,161 @@
+#include <stlab/polymorphic_copy_on_write.hpp>
+#include <stlab/reclaim.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <functional>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+using stlab::polymorphic_copy_on_write;
+
+namespace {
+
+struct shape {
+    static inline int instances = 0;
+
+    double _scale{1.0};
+
+    shape() { ++instances; }
+    shape(const shape& x) : _scale(x._scale) { ++instances; }
+    auto operator=(const shape&) -> shape& = default;
+    virtual ~shape() { --instances; }
+
+    [[nodiscard]] virtual auto area() const -> double = 0;
+    [[nodiscard]] virtual auto name() const -> std::string = 0;
+};
+
+struct square final : shape {
+    double _side;
+    explicit square(double side) : _side(side) {}
+    [[nodiscard]] auto area() const -> double override { return _side * _side * _scale; }
+    [[nodiscard]] auto name() const -> std::string override { return "square"; }
+};
+
+struct rectangle final : shape {
+    double _width;
+    double _height;
+    rectangle(double w, double h) : _width(w), _height(h) {}
+    [[nodiscard]] auto area() const -> double override { return _width * _height * _scale; }
+    [[nodiscard]] auto name() const -> std::string override { return "rectangle"; }
+};
+
+// A base without a virtual destructor; the model destroys the concrete type.
+struct tagged {
+    int _tag{0};
+};
+
+struct counted_tagged : tagged {
+    static inline int instances = 0;
+    counted_tagged() { ++instances; }
+    counted_tagged(const counted_tagged& x) : tagged(x) { ++instances; }
+    ~counted_tagged() { --instances; }
+};
+
+// A derived type much larger than its base.
+struct large_tagged : tagged {
+    static inline int instances = 0;
+    char _payload[4096]{};
+    large_tagged() { ++instances; }
+    large_tagged(const large_tagged& x) : tagged(x) { ++instances; }
+    ~large_tagged() { --instances; }
+};
+
+// An executor which queues tasks to be run by the test.
+struct manual_executor {
+    static inline std::vector<std::function<void()>> tasks;
+
+    template <class F>
+    void operator()(F&& f) const {
+        tasks.emplace_back(std::forward<F>(f));
+    }
+
+    static void run() {
+        auto pending = std::move(tasks);
+        tasks.clear();
+        for (auto& e : pending)
+            e();
+    }
+};
+
+using node = polymorphic_copy_on_write<shape>;
+
+} // namespace
+
+TEST_CASE("polymorphic_copy_on_write holds values of derived types") {
+    const int before = shape::instances;
+    {
+        std::vector<node> scene{square(2.0), rectangle(2.0, 3.0)};
+        scene.emplace_back(std::in_place_type<rectangle>, 1.0, 1.0);
+
+        CHECK(scene[0]->area() == 4.0);
+        CHECK(scene[1]->name() == "rectangle");
+        CHECK(scene[2].type() == typeid(rectangle));
+        CHECK(scene[0].target<square>()->_side == 2.0);
+        CHECK(scene[0].target<rectangle>() == nullptr);
+        CHECK(shape::instances == before + 3);
+
+        auto copy = scene;
+        CHECK(copy[0].identity(scene[0]));
+        CHECK(shape::instances == before + 3);
+
+        copy[0].write()._scale = 2.0;
+        CHECK_FALSE(copy[0].identity(scene[0]));
+        CHECK(copy[0].type() == typeid(square));
+        CHECK(copy[0]->area() == 8.0);
+        CHECK(scene[0]->area() == 4.0);
+        CHECK(shape::instances == before + 4);
+
+        shape* p = &copy[0].write();
+        CHECK(p == &*copy[0]);
+        CHECK(copy[0].unique());
+    }
+    CHECK(shape::instances == before);
+}
+
+TEST_CASE("polymorphic_copy_on_write assignment") {
+    node a = square(1.0);
+    node b = a;
+    a = rectangle(2.0, 5.0);
+    CHECK(a->area() == 10.0);
+    CHECK(b->name() == "square");
+    CHECK(b.unique());
+
+    b = std::move(a);
+    CHECK(b->name() == "rectangle");
+    swap(a, b);
+    CHECK(a->name() == "rectangle");
+}
+
+TEST_CASE("polymorphic_copy_on_write destroys the concrete type") {
+    const int before = counted_tagged::instances;
+    {
+        polymorphic_copy_on_write<tagged, stlab::threading::single> a = counted_tagged();
+        auto b = a;
+        b.write()._tag = 1;
+        CHECK(a->_tag == 0);
+        CHECK(b.target<counted_tagged>() != nullptr);
+        CHECK(counted_tagged::instances == before + 2);
+    }
+    CHECK(counted_tagged::instances == before);
+}
+
+TEST_CASE("polymorphic_copy_on_write reclaims with the concrete type") {
+    using policy = stlab::reclaim::deferred<1024, stlab::threading::multi, manual_executor>;
+    const int large_before = large_tagged::instances;
+    const int small_before = counted_tagged::instances;
+
+    { polymorphic_copy_on_write<tagged, policy> a = large_tagged(); }
+    CHECK(large_tagged::instances == large_before + 1);
+    CHECK(manual_executor::tasks.size() == 1);
+
+    { polymorphic_copy_on_write<tagged, policy> b = counted_tagged(); }
+    CHECK(counted_tagged::instances == small_before);
+    CHECK(manual_executor::tasks.size() == 1);
+
+    manual_executor::run();
+    CHECK(large_tagged::instances == large_before);
+}
@@ -0,0 +1,145 @@
+#include <stlab/pool_allocator.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <stlab/copy_on_write.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+using stlab::pool_allocator;
+
+TEST_CASE("pool_allocator recycles blocks") {
+    pool_allocator<std::string> alloc;
+
+    SUBCASE("a released block is reused by the same thread") {
+        std::string* p = alloc.allocate(1);
+        alloc.deallocate(p, 1);
+        std::string* q = alloc.allocate(1);
+        CHECK(p == q);
+        alloc.deallocate(q, 1);
+    }
+
+    SUBCASE("blocks are distinct and suitably aligned") {
+        std::vector<std::string*> blocks;
+        for (int i = 0; i != 1000; ++i)
+            blocks.push_back(alloc.allocate(1));
+        for (std::size_t i = 1; i != blocks.size(); ++i) {
+            CHECK(blocks[i] != blocks[i - 1]);
+        }
+        for (auto* p : blocks) {
+            CHECK(reinterpret_cast<std::uintptr_t>(p) % alignof(std::max_align_t) == 0);
+        }
+        for (auto* p : blocks)
+            alloc.deallocate(p, 1);
+    }
+
+    SUBCASE("array allocations bypass the pool") {
+        std::string* p = alloc.allocate(3);
+        CHECK(p != nullptr);
+        alloc.deallocate(p, 3);
+    }
+
+    SUBCASE("over-aligned types bypass the pool") {
+        struct alignas(64) line {
+            char _data[64];
+        };
+        pool_allocator<line> aligned(alloc);
+        line* p = aligned.allocate(1);
+        CHECK(reinterpret_cast<std::uintptr_t>(p) % 64 == 0);
+        aligned.deallocate(p, 1);
+    }
+
+    SUBCASE("rebound allocators compare equal") {
+        pool_allocator<int> other(alloc);
+        CHECK(other == alloc);
+        CHECK_FALSE(other != alloc);
+    }
+}
+
+TEST_CASE("pool_allocator across threads") {
+    // Blocks allocated on one thread and released on another move through the global depot.
+    constexpr int count = 10000;
+    std::vector<int*> blocks(count);
+
+    std::thread producer([&] {
+        pool_allocator<int> alloc;
+        for (auto& p : blocks) {
+            p = alloc.allocate(1);
+            *p = 42;
+        }
+    });
+    producer.join();
+
+    std::thread consumer([&] {
+        pool_allocator<int> alloc;
+        for (auto* p : blocks) {
+            CHECK(*p == 42);
+            alloc.deallocate(p, 1);
+        }
+    });
+    consumer.join();
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t != 4; ++t) {
+        workers.emplace_back([] {
+            pool_allocator<int> alloc;
+            std::vector<int*> local;
+            for (int round = 0; round != 100; ++round) {
+                for (int i = 0; i != 200; ++i)
+                    local.push_back(alloc.allocate(1));
+                for (auto* p : local)
+                    alloc.deallocate(p, 1);
+                local.clear();
+            }
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+}
+
+TEST_CASE("pool_allocator after the thread's cache is destroyed") {
+    // `late` is constructed before the thread's cache, so it is destroyed after it and its model
+    // is returned directly to the depot.
+    using cow = stlab::copy_on_write<std::vector<int>>;
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; ++t) {
+        threads.emplace_back([] {
+            thread_local std::vector<cow> late;
+            for (int i = 0; i != 200; ++i)
+                late.push_back(stlab::allocate_copy_on_write<std::vector<int>>(
+                    pool_allocator<int>(), 1, i));
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    // The recycled models are each handed out once.
+    std::vector<cow> values;
+    std::vector<const void*> models;
+    for (int i = 0; i != 2000; ++i) {
+        values.push_back(
+            stlab::allocate_copy_on_write<std::vector<int>>(pool_allocator<int>(), 1, i));
+        models.push_back(values.back().identity());
+    }
+    std::sort(models.begin(), models.end());
+    CHECK(std::adjacent_find(models.begin(), models.end()) == models.end());
+    CHECK(values[1234]->front() == 1234);
+}
+
+TEST_CASE("pool_allocator with copy_on_write") {
+    auto cow1 = stlab::allocate_copy_on_write<std::vector<int>>(pool_allocator<int>(), 3, 1);
+    stlab::copy_on_write<std::vector<int>> cow2(cow1);
+
+    cow2.write()[0] = 2;
+
+    CHECK((*cow1)[0] == 1);
+    CHECK((*cow2)[0] == 2);
+    CHECK(cow1.unique());
+    CHECK(cow2.unique());
+}
@@ -0,0 +1,268 @@
+#include <stlab/atomic_copy_on_write.hpp>
+#include <stlab/reclaim.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using stlab::atomic_copy_on_write;
+using stlab::copy_on_write;
+
+namespace {
+
+// Counts live instances so deferred destruction can be observed.
+struct tracked {
+    static inline std::atomic<int> live{0};
+    int _value = 0;
+
+    tracked() { ++live; }
+    explicit tracked(int x) : _value(x) { ++live; }
+    tracked(const tracked& x) : _value(x._value) { ++live; }
+    auto operator=(const tracked&) -> tracked& = default;
+    ~tracked() { --live; }
+};
+
+using policy = stlab::reclaim::epoch<>;
+
+// Records the thread that destroys it.
+struct destruction_site {
+    static inline std::atomic<std::thread::id> thread{};
+    std::vector<char> _payload;
+
+    explicit destruction_site(std::size_t n) : _payload(n) {}
+    destruction_site(const destruction_site&) = default;
+    auto operator=(const destruction_site&) -> destruction_site& = default;
+    ~destruction_site() { thread = std::this_thread::get_id(); }
+};
+
+} // namespace
+
+namespace stlab {
+
+template <>
+struct default_size_of<destruction_site> {
+    auto operator()(const destruction_site& x) const noexcept -> std::size_t {
+        return x._payload.capacity();
+    }
+};
+
+} // namespace stlab
+
+namespace {
+
+// An executor which queues tasks to be run by the test.
+struct manual_executor {
+    static inline std::vector<std::function<void()>> tasks;
+
+    template <class F>
+    void operator()(F&& f) const {
+        tasks.emplace_back(std::forward<F>(f));
+    }
+
+    static void run() {
+        auto pending = std::move(tasks);
+        tasks.clear();
+        for (auto& e : pending)
+            e();
+    }
+};
+
+} // namespace
+
+TEST_CASE("epoch reclamation defers destruction") {
+    stlab::reclaim::synchronize();
+    tracked::live = 0;
+
+    SUBCASE("without a guard models are destroyed by synchronize") {
+        { copy_on_write<tracked, policy> x(tracked(1)); }
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 0);
+    }
+
+    SUBCASE("a guard keeps released models alive") {
+        {
+            stlab::reclaim::epoch_guard guard;
+            { copy_on_write<tracked, policy> x(tracked(1)); }
+            CHECK(stlab::reclaim::collect() == 1);
+            CHECK(tracked::live == 1);
+            {
+                stlab::reclaim::epoch_guard nested;
+                CHECK(stlab::reclaim::collect() == 1);
+            }
+            CHECK(tracked::live == 1);
+        }
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 0);
+    }
+
+    SUBCASE("a guard on another thread keeps released models alive") {
+        std::atomic<int> state{0};
+        std::thread reader([&] {
+            stlab::reclaim::epoch_guard guard;
+            state = 1;
+            while (state != 2)
+                std::this_thread::yield();
+        });
+        while (state != 1)
+            std::this_thread::yield();
+
+        { copy_on_write<tracked, policy> x(tracked(1)); }
+        stlab::reclaim::collect();
+        stlab::reclaim::collect();
+        CHECK(tracked::live == 1);
+
+        state = 2;
+        reader.join();
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 0);
+    }
+}
+
+TEST_CASE("epoch reclamation of many models") {
+    stlab::reclaim::synchronize();
+    tracked::live = 0;
+
+    SUBCASE("models released under a guard are kept until it is destroyed") {
+        {
+            stlab::reclaim::epoch_guard guard;
+            for (int i = 0; i != 1000; ++i) {
+                copy_on_write<tracked, policy> x{tracked(i)};
+            }
+            CHECK(stlab::reclaim::collect() == 1000);
+            CHECK(tracked::live == 1000);
+        }
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 0);
+    }
+
+    SUBCASE("without a guard models are destroyed as later models are released") {
+        for (int i = 0; i != 1000; ++i) {
+            copy_on_write<tracked, policy> x{tracked(i)};
+        }
+        CHECK(tracked::live < 1000);
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 0);
+    }
+}
+
+TEST_CASE("atomic_copy_on_write borrow") {
+    stlab::reclaim::synchronize();
+    tracked::live = 0;
+
+    SUBCASE("borrow reads the published value") {
+        atomic_copy_on_write<tracked, policy> a(copy_on_write<tracked, policy>(tracked(1)));
+        {
+            auto guard = a.borrow();
+            CHECK(guard->_value == 1);
+            a.store(copy_on_write<tracked, policy>(tracked(2)));
+            CHECK(guard.get()._value == 1); // the replaced value is still alive
+            CHECK(a.borrow()->_value == 2);
+        }
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 1);
+    }
+
+    SUBCASE("published values are not modified in place") {
+        copy_on_write<tracked, policy> unpublished(tracked(0));
+        const tracked* p = &unpublished.read();
+        unpublished.write()._value = 1;
+        CHECK(&unpublished.read() == p);
+
+        atomic_copy_on_write<tracked, policy> a(std::move(unpublished));
+        {
+            auto guard = a.borrow();
+            auto old = a.exchange(copy_on_write<tracked, policy>(tracked(2)));
+            REQUIRE(old.unique());
+            old.write()._value = 3;
+            CHECK(guard->_value == 1);
+            CHECK(&old.read() != &guard.get());
+
+            auto current = a.load();
+            auto pinned = a.borrow();
+            a.store(copy_on_write<tracked, policy>(tracked(4)));
+            REQUIRE(current.unique());
+            current = tracked(5);
+            CHECK(current->_value == 5);
+            CHECK(pinned->_value == 2);
+        }
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 1);
+    }
+
+    SUBCASE("concurrent borrowers and writers") {
+        {
+            atomic_copy_on_write<tracked, policy> a(copy_on_write<tracked, policy>(tracked(0)));
+            std::atomic<bool> done{false};
+            std::atomic<bool> ordered{true};
+
+            std::vector<std::thread> readers;
+            for (int t = 0; t != 4; ++t) {
+                readers.emplace_back([&] {
+                    int last = 0;
+                    while (!done.load(std::memory_order_relaxed)) {
+                        auto guard = a.borrow();
+                        if (guard->_value < last) ordered = false;
+                        last = guard->_value;
+                    }
+                });
+            }
+
+            for (int i = 1; i != 5000; ++i)
+                a.store(copy_on_write<tracked, policy>(tracked(i)));
+            done = true;
+            for (auto& e : readers)
+                e.join();
+
+            CHECK(ordered);
+            CHECK(a.borrow()->_value == 4999);
+        }
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 0);
+    }
+}
+
+TEST_CASE("deferred reclamation of large values") {
+    using background = stlab::reclaim::deferred<1024>;
+    const auto here = std::this_thread::get_id();
+
+    SUBCASE("large values are destroyed on the background thread") {
+        { copy_on_write<destruction_site, background> x(destruction_site(4096)); }
+        stlab::reclaim::background_executor::wait_idle();
+        CHECK(destruction_site::thread.load() != here);
+    }
+
+    SUBCASE("small values are destroyed by the releasing thread") {
+        { copy_on_write<destruction_site, background> x(destruction_site(16)); }
+        CHECK(destruction_site::thread.load() == here);
+    }
+
+    SUBCASE("a user supplied executor") {
+        using manual = stlab::reclaim::deferred<1024, stlab::threading::multi, manual_executor>;
+        { copy_on_write<destruction_site, manual> x(destruction_site(4096)); }
+        CHECK(manual_executor::tasks.size() == 1);
+        destruction_site::thread = std::thread::id();
+        manual_executor::run();
+        CHECK(destruction_site::thread.load() == here);
+    }
+
+    SUBCASE("composes with epoch reclamation") {
+        using composed = stlab::reclaim::deferred<1024, policy>;
+        stlab::reclaim::synchronize();
+        tracked::live = 0;
+        atomic_copy_on_write<std::vector<tracked>, composed> a(
+            copy_on_write<std::vector<tracked>, composed>(std::vector<tracked>(512)));
+        {
+            auto guard = a.borrow();
+            a.store(copy_on_write<std::vector<tracked>, composed>());
+            stlab::reclaim::background_executor::wait_idle();
+            CHECK(guard->size() == 512);
+        }
+        stlab::reclaim::background_executor::wait_idle();
+        stlab::reclaim::synchronize();
+        CHECK(tracked::live == 0);
+    }
+}
@@ -0,0 +1,237 @@
+#include <stlab/weak_copy_on_write.hpp>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using stlab::weak_copy_on_write;
+
+namespace {
+
+using policy = stlab::references::weak<>;
+using handle = stlab::copy_on_write<std::string, policy>;
+using weak = weak_copy_on_write<std::string, policy>;
+
+struct counted {
+    static inline int instances = 0;
+    int _value{0};
+
+    counted() { ++instances; }
+    explicit counted(int v) : _value(v) { ++instances; }
+    counted(const counted& x) : _value(x._value) { ++instances; }
+    auto operator=(const counted&) -> counted& = default;
+    ~counted() { --instances; }
+};
+
+// Memoizes the length of strings, keyed on the identity of their value.
+class length_cache {
+    struct entry {
+        weak _source;
+        std::size_t _length;
+    };
+    std::unordered_map<const void*, entry> _entries;
+
+public:
+    std::size_t computed = 0;
+
+    auto length(const handle& x) -> std::size_t {
+        auto p = _entries.find(x.identity());
+        if (p != _entries.end() && p->second._source.identity(x)) return p->second._length;
+        ++computed;
+        std::size_t n = x->size();
+        _entries.insert_or_assign(x.identity(), entry{weak(x), n});
+        return n;
+    }
+
+    void purge() {
+        for (auto p = _entries.begin(); p != _entries.end();) {
+            if (p->second._source.expired()) {
+                p = _entries.erase(p);
+            } else {
+                ++p;
+            }
+        }
+    }
+
+    auto size() const -> std::size_t { return _entries.size(); }
+};
+
+} // namespace
+
+TEST_CASE("weak_copy_on_write does not keep the value alive") {
+    using counted_handle = stlab::copy_on_write<counted, policy>;
+    const int before = counted::instances;
+
+    weak_copy_on_write<counted, policy> w;
+    CHECK(w.expired());
+    CHECK_FALSE(w.lock());
+    {
+        counted_handle a(42);
+        w = a;
+        CHECK_FALSE(w.expired());
+        CHECK(w.identity(a));
+        CHECK(a.unique());
+
+        auto locked = w.lock();
+        REQUIRE(locked);
+        CHECK(locked->identity(a));
+        CHECK((*locked)->_value == 42);
+        CHECK_FALSE(a.unique());
+    }
+    CHECK(counted::instances == before);
+    CHECK(w.expired());
+    CHECK_FALSE(w.lock());
+}
+
+TEST_CASE("weak_copy_on_write copies share the reference") {
+    handle a("value");
+    weak w1(a);
+    weak w2 = w1;
+    CHECK(w1.identity(w2));
+
+    weak w3(std::move(w2));
+    CHECK(w3.identity(w1));
+
+    weak other(handle("other"));
+    CHECK(other.expired());
+    CHECK_FALSE(other.identity(w1));
+
+    a = handle("replaced");
+    CHECK(w1.expired());
+    CHECK(w3.expired());
+}
+
+TEST_CASE("values with weak handles are not modified in place") {
+    handle a("original");
+    const void* id = a.identity();
+
+    SUBCASE("without weak handles writes are in place") {
+        a.write() += "!";
+        CHECK(a.identity() == id);
+    }
+
+    SUBCASE("write expires the weak handles to a unique value and writes in place") {
+        weak w(a);
+        weak w2 = w;
+        a.write() += "!";
+        CHECK(a.identity() == id);
+        CHECK(w.expired());
+        CHECK(w2.expired());
+        CHECK_FALSE(w.identity(a));
+        CHECK_FALSE(w.lock());
+        CHECK(*a == "original!");
+
+        weak w3(a);
+        CHECK(w3.identity(a));
+        CHECK_FALSE(w3.identity(w));
+    }
+
+    SUBCASE("write copies an observed value which is shared") {
+        weak w(a);
+        handle b = a;
+        a.write() += "!";
+        CHECK(a.identity() != id);
+        CHECK(w.identity(b));
+        CHECK(*b == "original");
+        CHECK(*a == "original!");
+    }
+
+    SUBCASE("assignment copies an observed value") {
+        weak w(a);
+        auto keep = w.lock();
+        a = std::string("assigned");
+        CHECK(**keep == "original");
+        CHECK(w.identity(*keep));
+    }
+
+    SUBCASE("writes are in place once the weak handles are gone") {
+        { weak w(a); }
+        a.write() += "!";
+        CHECK(a.identity() == id);
+    }
+}
+
+TEST_CASE("weak_copy_on_write lock races with an in place write") {
+    std::atomic<int> mismatches{0};
+    for (int round = 0; round != 100; ++round) {
+        handle a(std::string(64, 'x'));
+        weak w(a);
+        std::thread reader([w, &mismatches] {
+            for (int i = 0; i != 50; ++i) {
+                if (auto x = w.lock()) {
+                    if (**x != std::string(64, 'x')) ++mismatches;
+                }
+            }
+        });
+        a.write().assign(64, 'y');
+        reader.join();
+        CHECK(*a == std::string(64, 'y'));
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE("weak_copy_on_write of a default constructed value") {
+    handle a;
+    weak w(a);
+    CHECK_FALSE(w.expired());
+    auto locked = w.lock();
+    REQUIRE(locked);
+    CHECK(locked->identity(a));
+    CHECK((*locked)->empty());
+}
+
+TEST_CASE("weak_copy_on_write keys a memoization cache") {
+    length_cache cache;
+
+    handle a("four");
+    handle b = a;
+    CHECK(cache.length(a) == 4);
+    CHECK(cache.length(b) == 4);
+    CHECK(cache.computed == 1);
+
+    b.write() += " more";
+    CHECK(cache.length(b) == 9);
+    CHECK(cache.computed == 2);
+    CHECK(cache.length(a) == 4);
+    CHECK(cache.computed == 2);
+
+    a = handle("x");
+    (void)cache.length(a);
+    cache.purge();
+    CHECK(cache.size() == 2);
+
+    b = handle("y");
+    cache.purge();
+    CHECK(cache.size() == 1);
+}
+
+TEST_CASE("weak_copy_on_write lock races with release") {
+    std::atomic<int> mismatches{0};
+    for (int round = 0; round != 100; ++round) {
+        auto strong = std::make_unique<handle>(std::string(64, 'x'));
+        weak w(*strong);
+        std::vector<std::thread> threads;
+        for (int t = 0; t != 3; ++t) {
+            threads.emplace_back([w, &mismatches] {
+                for (int i = 0; i != 50; ++i) {
+                    if (auto x = w.lock()) {
+                        if ((*x)->size() != 64) ++mismatches;
+                    }
+                }
+            });
+        }
+        strong.reset();
+        for (auto& t : threads)
+            t.join();
+        CHECK(w.expired());
+    }
+    CHECK(mismatches == 0);
+}